@@ -0,0 +1,455 @@
+#include "generator.hpp"
+
+#include <callgraph.hpp>
+#include <context.hpp>
+#include <flat.hpp>
+#include <lexer.hpp>
+#include <parser.hpp>
+#include <printer.hpp>
+#include <resolver.hpp>
+#include <source.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <span>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include <sys/resource.h>
+
+#if __has_include(<malloc.h>)
+#include <malloc.h>
+#endif
+
+static std::atomic<size_t> allocations;
+static std::atomic<size_t> allocatedBytes;
+
+auto operator new(size_t size) -> void * {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+auto operator new[](size_t size) -> void * { return operator new(size); }
+auto operator delete(void *p) noexcept -> void { std::free(p); }
+auto operator delete[](void *p) noexcept -> void { std::free(p); }
+auto operator delete(void *p, size_t) noexcept -> void { std::free(p); }
+auto operator delete[](void *p, size_t) noexcept -> void { std::free(p); }
+
+struct NullBuffer : std::streambuf {
+  auto overflow(int c) -> int override { return c; }
+  auto xsputn(const char *, std::streamsize n) -> std::streamsize override {
+    return n;
+  }
+};
+
+struct Phase {
+  double seconds = 0;
+  size_t allocations = 0;
+  size_t bytes = 0;
+};
+
+struct Result {
+  Generator::Kind kind;
+  size_t bytes;
+  size_t tokens = 0;
+  size_t nodes = 0;
+  Phase lex, parse, print, free;
+  Phase flatten, walk, flatWalk, flatPrint;
+  Phase parallelParse;
+  Phase lazyParse, callGraph;
+  Phase resolve;
+  size_t functions = 0;
+  long peakRss = 0;
+};
+
+// Runs f once and folds its time and allocations into phase, keeping the
+// fastest of the repetitions.
+template <class F> auto measure(Phase &phase, bool first, F &&f) {
+  size_t count = allocations.load();
+  size_t bytes = allocatedBytes.load();
+  auto start = std::chrono::steady_clock::now();
+  auto result = f();
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  if (first || elapsed.count() < phase.seconds)
+    phase.seconds = elapsed.count();
+  phase.allocations = allocations.load() - count;
+  phase.bytes = allocatedBytes.load() - bytes;
+  return result;
+}
+
+// Counts AST nodes by kind, in FlatAST::Kind order, by chasing pointers. The
+// walk keeps its own stack so that deeply nested corpora cannot overflow the
+// native one.
+struct Counter {
+  using Node = std::variant<const Expr *, const Stmt *>;
+
+  std::array<size_t, 20> histogram{};
+  std::vector<Node> stack;
+
+  auto kind(const Expr *expr) -> size_t { return expr->expr.index(); }
+  auto kind(const Stmt *stmt) -> size_t {
+    return std::variant_size_v<decltype(Expr::expr)> + stmt->stmt.index();
+  }
+
+  template <class T> auto count(std::span<T *> nodes) -> size_t {
+    size_t n = 0;
+    push(nodes);
+    while (!stack.empty()) {
+      auto node = stack.back();
+      stack.pop_back();
+      n += std::visit(
+          [this](const auto *node) -> size_t {
+            if (!node)
+              return 0;
+            histogram[kind(node)]++;
+            node->accept([this](const auto &n) { push(n); });
+            return 1;
+          },
+          node);
+    }
+    return n;
+  }
+
+  auto push(std::initializer_list<Node> nodes) -> void {
+    stack.insert(stack.end(), nodes);
+  }
+  template <class T> auto push(std::span<T *> nodes) -> void {
+    stack.insert(stack.end(), nodes.begin(), nodes.end());
+  }
+
+  auto push(const Expr::Assign &expr) -> void { push({expr.value}); }
+  auto push(const Expr::Binary &expr) -> void {
+    push({expr.left, expr.right});
+  }
+  auto push(const Expr::Call &expr) -> void {
+    push({expr.callee});
+    push(expr.arguments);
+  }
+  auto push(const Expr::Get &expr) -> void { push({expr.object}); }
+  auto push(const Expr::Grouping &expr) -> void { push({expr.expression}); }
+  auto push(const Expr::Literal &) -> void {}
+  auto push(const Expr::Logical &expr) -> void {
+    push({expr.left, expr.right});
+  }
+  auto push(const Expr::Set &expr) -> void { push({expr.object, expr.value}); }
+  auto push(const Expr::This &) -> void {}
+  auto push(const Expr::Unary &expr) -> void { push({expr.right}); }
+  auto push(const Expr::Variable &) -> void {}
+
+  auto push(const Stmt::Block &stmt) -> void { push(stmt.statements); }
+  auto push(const Stmt::Break &) -> void {}
+  auto push(const Stmt::Expression &stmt) -> void { push({stmt.expression}); }
+  auto push(const Stmt::Function &stmt) -> void {
+    push({Parser::body(stmt)});
+  }
+  auto push(const Stmt::If &stmt) -> void {
+    push({stmt.condition, stmt.thenBranch, stmt.elseBranch});
+  }
+  auto push(const Stmt::Print &stmt) -> void { push({stmt.expression}); }
+  auto push(const Stmt::Return &stmt) -> void { push({stmt.value}); }
+  auto push(const Stmt::Var &stmt) -> void { push({stmt.initializer}); }
+  auto push(const Stmt::While &stmt) -> void {
+    push({stmt.condition, stmt.body});
+  }
+};
+
+// A field of /proc/self/status in kilobytes, or 0 where there is none.
+auto status(std::string_view field) -> long {
+  std::ifstream status("/proc/self/status");
+  for (std::string line; std::getline(status, line);)
+    if (line.starts_with(field))
+      return std::atol(line.data() + field.size());
+  return 0;
+}
+
+// Resets the peak resident set size to the current one, and returns that.
+// Memory freed by earlier corpora is handed back first, so that reusing it
+// still counts. Only Linux supports this; elsewhere the peak is that of the
+// whole run.
+auto resetPeakRss() -> long {
+#if __has_include(<malloc.h>) && defined(__GLIBC__)
+  malloc_trim(0);
+#endif
+  std::ofstream("/proc/self/clear_refs") << "5";
+  return status("VmRSS:");
+}
+
+auto peakRss() -> long {
+  if (auto peak = status("VmHWM:"))
+    return peak;
+
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+auto run(Generator::Kind kind, size_t bytes, uint32_t seed, int repeat,
+         size_t maxNesting, unsigned threads, const std::string &output)
+    -> Result {
+  // Earlier corpora stay in the SourceManager, so each one reports how far
+  // its peak rose above what the process held before it.
+  Result result{kind, bytes};
+  auto baseline = resetPeakRss();
+
+  auto name = std::format("{}-{}.bds", Generator::name(kind), bytes);
+  auto text = Generator(kind, seed).generate(bytes);
+  result.bytes = text.size();
+  if (!output.empty())
+    std::ofstream(output + "/" + name, std::ios::binary) << text;
+  auto added = SourceManager::instance().add(name, std::move(text));
+  if (!added) {
+    std::cerr << "Too many sources to add " << name << std::endl;
+    std::exit(1);
+  }
+  auto file = *added;
+
+  NullBuffer null;
+  for (int i = 0; i < repeat; i++) {
+    auto tokens = measure(result.lex, i == 0,
+                          [&] { return Lexer(file).scanTokens(); });
+    if (!tokens) {
+      tokens.error().print();
+      std::exit(1);
+    }
+    result.tokens = tokens->size();
+
+    ASTContext parallelContext;
+    Parser parallelParser(*tokens, parallelContext, maxNesting);
+    auto parallel = measure(result.parallelParse, i == 0, [&] {
+      return parallelParser.parseTokens(threads);
+    });
+    if (!parallel) {
+      parallel.error().print();
+      std::exit(1);
+    }
+
+    // Only the bodies reachable from the first function are parsed after a
+    // lazy parse; the eager parse below parses every one of them.
+    ASTContext lazyContext;
+    Parser lazyParser(*tokens, lazyContext, maxNesting, true);
+    auto lazy = measure(result.lazyParse, i == 0,
+                        [&] { return lazyParser.parseTokens(); });
+    if (!lazy) {
+      lazy.error().print();
+      std::exit(1);
+    }
+    result.functions = measure(result.callGraph, i == 0, [&] {
+      return reachable(*lazy, "f0").size();
+    });
+
+    auto context = std::make_unique<ASTContext>();
+    auto statements = measure(result.parse, i == 0, [&] {
+      return Parser(std::move(*tokens), *context, maxNesting).parseTokens();
+    });
+    if (!statements) {
+      statements.error().print();
+      std::exit(1);
+    }
+    Counter counter;
+    result.nodes = measure(result.walk, i == 0, [&] {
+      return counter.count(std::span(*statements));
+    });
+
+    auto flat = measure(result.flatten, i == 0,
+                        [&] { return FlatAST::build(*statements); });
+    auto histogram = measure(result.flatWalk, i == 0, [&] {
+      std::array<size_t, 20> histogram{};
+      flat.walk(
+          [&](NodeId, FlatAST::Kind kind) { histogram[size_t(kind)]++; });
+      return histogram;
+    });
+    // The generated programs use names they never declare, so every error
+    // is collected rather than stopping at the limit.
+    Diagnostics diagnostics(0);
+    measure(result.resolve, i == 0,
+            [&] { return resolve(*statements, diagnostics); });
+
+    Counter parallelCounter;
+    parallelCounter.count(std::span(*parallel));
+    if (parallelCounter.histogram != counter.histogram) {
+      std::cerr << "Parallel parse does not match " << name << std::endl;
+      std::exit(1);
+    }
+    if (histogram != counter.histogram) {
+      std::cerr << "Flat AST does not match " << name << std::endl;
+      std::exit(1);
+    }
+
+    auto *previous = std::cout.rdbuf(&null);
+    measure(result.print, i == 0, [&] {
+      Printer().print(*statements);
+      return 0;
+    });
+    measure(result.flatPrint, i == 0, [&] {
+      Printer().print(flat);
+      return 0;
+    });
+    std::cout.rdbuf(previous);
+
+    measure(result.free, i == 0, [&] {
+      context.reset();
+      return 0;
+    });
+  }
+
+  result.peakRss = peakRss() - baseline;
+  return result;
+}
+
+auto json(const Phase &phase, const Result &result, std::string_view rate,
+          size_t items) -> std::string {
+  return std::format(
+      R"({{"seconds": {:.6f}, "mb_per_s": {:.2f}, "{}": {:.0f}, )"
+      R"("allocations": {}, "allocated_bytes": {}}})",
+      phase.seconds, result.bytes / phase.seconds / 1e6, rate,
+      items / phase.seconds, phase.allocations, phase.bytes);
+}
+
+auto parseSize(std::string_view text) -> std::optional<size_t> {
+  size_t multiplier = 1;
+  if (text.ends_with('K') || text.ends_with('k'))
+    multiplier = 1 << 10;
+  else if (text.ends_with('M') || text.ends_with('m'))
+    multiplier = 1 << 20;
+  if (multiplier != 1)
+    text.remove_suffix(1);
+
+  size_t value;
+  auto [end, error] =
+      std::from_chars(text.data(), text.data() + text.size(), value);
+  if (error != std::errc() || end != text.data() + text.size())
+    return std::nullopt;
+  return value * multiplier;
+}
+
+auto split(std::string_view text) -> std::vector<std::string_view> {
+  std::vector<std::string_view> parts;
+  while (!text.empty()) {
+    auto comma = text.find(',');
+    parts.push_back(text.substr(0, comma));
+    text.remove_prefix(comma == text.npos ? text.size() : comma + 1);
+  }
+  return parts;
+}
+
+auto main(int argc, const char *argv[]) -> int {
+  std::vector<Generator::Kind> kinds = {
+      Generator::Kind::Functions, Generator::Kind::Expressions,
+      Generator::Kind::Strings, Generator::Kind::Comments};
+  std::vector<size_t> sizes = {1 << 10, 64 << 10, 1 << 20, 16 << 20};
+  uint32_t seed = 1;
+  int repeat = 3;
+  size_t maxNesting = std::numeric_limits<size_t>::max();
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  std::string output;
+
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+    auto value = arg.substr(arg.find('=') + 1);
+
+    if (arg.starts_with("--corpus=")) {
+      kinds.clear();
+      for (auto name : split(value)) {
+        auto kind = Generator::parse(name);
+        if (!kind) {
+          std::cerr << "Unknown corpus " << name << std::endl;
+          return 1;
+        }
+        kinds.push_back(*kind);
+      }
+    } else if (arg.starts_with("--sizes=")) {
+      sizes.clear();
+      for (auto text : split(value)) {
+        auto size = parseSize(text);
+        if (!size) {
+          std::cerr << "Invalid size " << text << std::endl;
+          return 1;
+        }
+        sizes.push_back(*size);
+      }
+    } else if (arg.starts_with("--repeat=")) {
+      repeat = std::max(1, std::atoi(value.data()));
+    } else if (arg.starts_with("--seed=")) {
+      seed = std::atoi(value.data());
+    } else if (arg.starts_with("--max-nesting=")) {
+      maxNesting = std::strtoull(value.data(), nullptr, 10);
+    } else if (arg.starts_with("--threads=")) {
+      threads = std::max(1, std::atoi(value.data()));
+    } else if (arg.starts_with("--output=")) {
+      output = value;
+    } else {
+      std::cerr << "Usage: bds-bench [--corpus=functions,expressions,strings,"
+                   "comments,nested] [--sizes=1K,64K,1M,16M] [--repeat=N] "
+                   "[--seed=N] [--max-nesting=N] [--threads=N] "
+                   "[--output=DIR]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "{\"results\": [";
+  bool first = true;
+  for (auto kind : kinds) {
+    for (auto size : sizes) {
+      auto result = run(kind, size, seed, repeat, maxNesting, threads, output);
+      std::cout << (first ? "\n" : ",\n")
+                << std::format(
+                       R"(  {{"corpus": "{}", "bytes": {}, "tokens": {}, )"
+                       R"("nodes": {}, "peak_rss_kb": {}, "phases": {{)",
+                       Generator::name(kind), result.bytes, result.tokens,
+                       result.nodes, result.peakRss)
+                << "\n    \"lex\": "
+                << json(result.lex, result, "tokens_per_s", result.tokens)
+                << ",\n    \"parse\": "
+                << json(result.parse, result, "nodes_per_s", result.nodes)
+                << ",\n    \"print\": "
+                << json(result.print, result, "nodes_per_s", result.nodes)
+                << ",\n    \"free\": "
+                << json(result.free, result, "nodes_per_s", result.nodes)
+                << ",\n    \"flatten\": "
+                << json(result.flatten, result, "nodes_per_s", result.nodes)
+                << ",\n    \"walk\": "
+                << json(result.walk, result, "nodes_per_s", result.nodes)
+                << ",\n    \"flat_walk\": "
+                << json(result.flatWalk, result, "nodes_per_s", result.nodes)
+                << ",\n    \"flat_print\": "
+                << json(result.flatPrint, result, "nodes_per_s", result.nodes)
+                << ",\n    \"parallel_parse\": "
+                << json(result.parallelParse, result, "nodes_per_s",
+                        result.nodes)
+                << ",\n    \"lazy_parse\": "
+                << json(result.lazyParse, result, "tokens_per_s",
+                        result.tokens)
+                << ",\n    \"reachable\": "
+                << json(result.callGraph, result, "functions_per_s",
+                        result.functions)
+                << ",\n    \"resolve\": "
+                << json(result.resolve, result, "nodes_per_s", result.nodes)
+                << "}}" << std::flush;
+      first = false;
+    }
+  }
+  std::cout << "\n]}" << std::endl;
+
+  return 0;
+}
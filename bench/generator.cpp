@@ -0,0 +1,314 @@
+#include "generator.hpp"
+
+#include <format>
+
+auto Generator::name(Kind kind) -> std::string_view {
+  switch (kind) {
+  case Kind::Functions:
+    return "functions";
+  case Kind::Expressions:
+    return "expressions";
+  case Kind::Strings:
+    return "strings";
+  case Kind::Comments:
+    return "comments";
+  case Kind::Nested:
+    return "nested";
+  }
+  return "unknown";
+}
+
+auto Generator::parse(std::string_view name) -> std::optional<Kind> {
+  for (auto kind : {Kind::Functions, Kind::Expressions, Kind::Strings,
+                    Kind::Comments, Kind::Nested})
+    if (Generator::name(kind) == name)
+      return kind;
+  return std::nullopt;
+}
+
+Generator::Generator(Kind kind, uint32_t seed) : kind(kind), rng(seed) {}
+
+auto Generator::generate(size_t bytes) -> std::string {
+  out.clear();
+  out.reserve(bytes + 4096);
+  functions = 0;
+
+  if (kind == Kind::Nested) {
+    nested(bytes);
+    return std::move(out);
+  }
+
+  while (out.size() < bytes) {
+    if (kind == Kind::Comments || chance(10))
+      comment();
+    function();
+  }
+
+  return std::move(out);
+}
+
+auto Generator::chance(unsigned percent) -> bool {
+  return rng() % 100 < percent;
+}
+
+auto Generator::pick(std::initializer_list<std::string_view> options)
+    -> std::string_view {
+  return options.begin()[rng() % options.size()];
+}
+
+auto Generator::indent(int depth) -> void { out.append(2 * depth, ' '); }
+
+auto Generator::identifier() -> void {
+  out += pick({"a", "b", "count", "total", "index", "value", "left_side",
+               "rightSide", "x1", "_tmp"});
+}
+
+auto Generator::literal() -> void {
+  switch (rng() % 4) {
+  case 0:
+    out += std::to_string(rng() % 10000);
+    break;
+  case 1:
+    out += std::format("{}.{}", rng() % 1000, rng() % 100);
+    break;
+  case 2:
+    out += pick({"true", "false"});
+    break;
+  default:
+    out += '"';
+    out += pick({"hello", "world", "a short string", "x"});
+    out += '"';
+    break;
+  }
+}
+
+auto Generator::expression(int depth) -> void {
+  bool deep = kind == Kind::Expressions;
+  int maxDepth = deep ? 48 : 3;
+  int leaf = depth == 0 ? 10 : deep && depth >= 2 ? 3 : 35;
+
+  if (depth >= maxDepth || chance(leaf)) {
+    chance(50) ? identifier() : literal();
+    return;
+  }
+
+  // Deep expressions only branch near the root; below that they grow along
+  // a single spine so the size stays linear in the depth.
+  if (deep && depth >= 2) {
+    switch (rng() % 3) {
+    case 0:
+      out += '(';
+      expression(depth + 1);
+      out += ')';
+      break;
+    case 1:
+      out += pick({"- ", "!"});
+      expression(depth + 1);
+      break;
+    default:
+      literal();
+      out += pick({" + ", " * ", " < ", " == ", " and "});
+      expression(depth + 1);
+      break;
+    }
+    return;
+  }
+
+  switch (rng() % 6) {
+  case 0:
+  case 1: {
+    int operands = deep ? 2 + rng() % 6 : 2;
+    for (int i = 0; i < operands; i++) {
+      if (i > 0)
+        out += pick({" + ", " - ", " * ", " / ", " % ", " == ", " != ", " < ",
+                     " <= ", " > ", " >= ", " and ", " or "});
+      expression(depth + 1);
+    }
+  } break;
+  case 2:
+    out += '(';
+    expression(depth + 1);
+    out += ')';
+    break;
+  case 3:
+    out += pick({"- ", "!"});
+    expression(depth + 1);
+    break;
+  case 4: {
+    out += std::format("f{}(", rng() % (functions + 1));
+    int arguments = rng() % 4;
+    for (int i = 0; i < arguments; i++) {
+      if (i > 0)
+        out += ", ";
+      expression(depth + 1);
+    }
+    out += ')';
+  } break;
+  default:
+    out += '(';
+    expression(depth + 1);
+    out += pick({" and ", " or "});
+    expression(depth + 1);
+    out += ')';
+    break;
+  }
+}
+
+auto Generator::statement(int depth, bool declaration) -> void {
+  indent(depth);
+
+  if (kind == Kind::Strings && chance(60)) {
+    out += declaration ? "let s = \"" : "print \"";
+    size_t length = 200 + rng() % 1800;
+    for (size_t i = 0; i < length; i++)
+      out += "abcdefghijklmnopqrstuvwxyz  ,.\n"[rng() % 31];
+    out += "\";\n";
+    return;
+  }
+
+  int kinds = depth >= 3 ? 4 : 7;
+  switch (rng() % kinds) {
+  case 0:
+    out += "print ";
+    expression(0);
+    out += ";\n";
+    break;
+  case 1:
+    if (declaration) {
+      out += "let ";
+      identifier();
+      out += " = ";
+      expression(0);
+      out += ";\n";
+      break;
+    }
+    [[fallthrough]];
+  case 2:
+    identifier();
+    out += " = ";
+    expression(0);
+    out += ";\n";
+    break;
+  case 3:
+    out += std::format("f{}(", rng() % (functions + 1));
+    expression(1);
+    out += ");\n";
+    break;
+  case 4:
+    out += "if (";
+    expression(0);
+    out += ")\n";
+    statement(depth + 1, false);
+    indent(depth);
+    out += "else\n";
+    statement(depth + 1, false);
+    break;
+  case 5:
+    out += "while (";
+    expression(0);
+    out += ")\n";
+    statement(depth + 1, false);
+    break;
+  default: {
+    out += "{\n";
+    int statements = 1 + rng() % 4;
+    for (int i = 0; i < statements; i++)
+      statement(depth + 1, true);
+    indent(depth);
+    out += "}\n";
+  } break;
+  }
+}
+
+auto Generator::function() -> void {
+  out += std::format("fn f{}(", functions++);
+  int parameters = rng() % 4;
+  for (int i = 0; i < parameters; i++)
+    out += std::format("{}p{}", i > 0 ? ", " : "", i);
+  out += ") {\n";
+
+  int statements = 1 + rng() % 8;
+  for (int i = 0; i < statements; i++)
+    statement(1, true);
+
+  out += "}\n\n";
+}
+
+auto Generator::comment() -> void {
+  int lines = 1 + rng() % 6;
+  switch (rng() % 3) {
+  case 0:
+    for (int i = 0; i < lines; i++)
+      out += "// Lorem ipsum dolor sit amet, consectetur adipiscing elit.\n";
+    break;
+  case 1:
+    for (int i = 0; i < lines; i++)
+      out += "# sed do eiusmod tempor incididunt ut labore et dolore\n";
+    break;
+  default:
+    out += "/*\n";
+    for (int i = 0; i < lines; i++)
+      out += " * Ut enim ad minim veniam, quis nostrud exercitation.\n";
+    out += " */\n";
+    break;
+  }
+}
+
+// One statement nested about bytes / 8 levels deep, wrapping an expression
+// nested just as deeply. Built with an explicit stack of closers so that the
+// generator itself does not recurse.
+auto Generator::nested(size_t bytes) -> void {
+  std::vector<std::string_view> closers;
+  auto close = [&] {
+    for (auto closer = closers.rbegin(); closer != closers.rend(); ++closer)
+      out += *closer;
+    closers.clear();
+  };
+
+  while (out.size() < bytes / 2) {
+    switch (rng() % 3) {
+    case 0:
+      out += "{ ";
+      closers.push_back(" }");
+      break;
+    case 1:
+      out += "if (a) ";
+      closers.push_back("");
+      break;
+    default:
+      out += "while (b) ";
+      closers.push_back("");
+      break;
+    }
+  }
+
+  out += "print ";
+  std::vector<std::string_view> statements;
+  std::swap(statements, closers);
+  while (out.size() < bytes) {
+    switch (rng() % 4) {
+    case 0:
+      out += "(";
+      closers.push_back(")");
+      break;
+    case 1:
+      out += pick({"- ", "!"});
+      closers.push_back("");
+      break;
+    case 2:
+      out += "1 + (";
+      closers.push_back(")");
+      break;
+    default:
+      out += "f(";
+      closers.push_back(")");
+      break;
+    }
+  }
+  out += 'x';
+  close();
+  out += ";";
+  std::swap(statements, closers);
+  close();
+  out += '\n';
+}
@@ -0,0 +1,44 @@
+#ifndef GENERATOR_HPP
+#define GENERATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Generates syntactically valid bds programs of roughly a requested size.
+// The same kind, size and seed always produce the same program.
+class Generator {
+public:
+  enum class Kind { Functions, Expressions, Strings, Comments, Nested };
+
+  static auto name(Kind kind) -> std::string_view;
+  static auto parse(std::string_view name) -> std::optional<Kind>;
+
+  Generator(Kind kind, uint32_t seed = 1);
+
+  auto generate(size_t bytes) -> std::string;
+
+private:
+  Kind kind;
+  std::mt19937 rng;
+  std::string out;
+  int functions = 0;
+
+  auto chance(unsigned percent) -> bool;
+  auto pick(std::initializer_list<std::string_view> options)
+      -> std::string_view;
+  auto indent(int depth) -> void;
+  auto identifier() -> void;
+  auto literal() -> void;
+  auto expression(int depth) -> void;
+  auto statement(int depth, bool declaration) -> void;
+  auto function() -> void;
+  auto comment() -> void;
+  auto nested(size_t bytes) -> void;
+};
+
+#endif // GENERATOR_HPP
@@ -0,0 +1,47 @@
+#ifndef BACKEND_HPP
+#define BACKEND_HPP
+
+#include <optimizer.hpp>
+
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+// Writes modules as LLVM IR, bitcode or native code for the host's target
+// triple. The CPU may be "native" for the host's own CPU and features, and
+// features are a comma-separated list of +name and -name as in -mattr,
+// applied after the CPU's, and LLVM warns about any it does not know.
+// Executables are linked by the system's C compiler, which is found as cc on
+// the PATH. A TargetMachine is not safe to share between threads, so every
+// thread that needs one makes its own copy.
+struct Backend {
+  enum class Output { Llvm, Bitcode, Assembly, Object, Executable };
+
+  std::unique_ptr<llvm::TargetMachine> machine;
+
+  static auto create(std::string_view cpu, std::string_view features,
+                     Optimizer::Level level)
+      -> std::expected<Backend, std::string>;
+
+  static auto name(Output output) -> std::string_view;
+
+  auto copy() const -> Backend;
+
+  // Sets the triple and data layout of module, which the optimizer needs
+  // to know the target.
+  auto prepare(llvm::Module &module) const -> void;
+  // Writes modules as one output to path, or to standard output if path is
+  // "-". The objects of several modules are generated on up to threads
+  // threads and linked by cc, into one relocatable object for Object. Any
+  // other output is generated from the modules linked into the first.
+  auto emit(std::span<llvm::Module *const> modules, Output output,
+            const std::string &path, unsigned threads = 1) const
+      -> std::expected<void, std::string>;
+};
+
+#endif // BACKEND_HPP
@@ -0,0 +1,36 @@
+#ifndef CACHE_HPP
+#define CACHE_HPP
+
+#include <flat.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+// A parsed source file stored on disk as its FlatAST tables, under a name
+// made of a hash of the source text and an identity of the running build of
+// bds. The file is a header followed by each table as raw native-endian
+// words, so loading it is a mapping and a few copies. Tokens refer to the
+// source by offset, so only the source itself has to be loaded on a hit.
+class Cache {
+  uint32_t file;
+  size_t maxNesting;
+  std::filesystem::path path;
+
+public:
+  // Entries written with a different nesting limit are not reused, since
+  // the limit decides whether the source parses at all.
+  Cache(const std::filesystem::path &directory, uint32_t file,
+        size_t maxNesting);
+
+  auto entry() const -> const std::filesystem::path & { return path; }
+
+  // The cached tables, or nothing if they are missing, stale or damaged.
+  auto load() const -> std::optional<FlatAST>;
+  // Replaces the entry atomically. Returns false if it could not be
+  // written.
+  auto store(const FlatAST &ast) const -> bool;
+};
+
+#endif // CACHE_HPP
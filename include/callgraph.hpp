@@ -0,0 +1,18 @@
+#ifndef CALLGRAPH_HPP
+#define CALLGRAPH_HPP
+
+#include <stmt.hpp>
+
+#include <span>
+#include <string_view>
+#include <vector>
+
+// The top-level functions reachable from the function named entry and from
+// the top-level statements outside any function, in the order they are first
+// reached. Any use of a function's name counts as a call. Only the bodies of
+// reachable functions are parsed, so after a lazy parse the rest are never
+// built.
+auto reachable(std::span<Stmt *const> statements, std::string_view entry)
+    -> std::vector<const Stmt::Function *>;
+
+#endif // CALLGRAPH_HPP
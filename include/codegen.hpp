@@ -1,17 +1,149 @@
 #ifndef CODEGEN_HPP
 #define CODEGEN_HPP
 
+#include <diagnostics.hpp>
 #include <expr.hpp>
+#include <resolver.hpp>
 #include <stmt.hpp>
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
-#include <variant>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
 #include <llvm/IR/Value.h>
 
+struct Compiler;
+
+// A resolved program, split into shards of shardSize top-level functions
+// that are each lowered into a module of their own. The first shard also
+// holds the top-level statements, the top-level variables and the C main.
+// Shards only depend on the program, so its modules are the same whatever
+// the number of threads that lowers them.
+struct Program {
+  static constexpr size_t shardSize = 64;
+
+  // The top-level function and variable a global names, if any.
+  struct Global {
+    const Stmt *function = nullptr;
+    const Stmt *variable = nullptr;
+  };
+
+  std::span<Stmt *const> statements;
+  Resolution resolution;
+  std::vector<Global> globals;
+  // Top-level functions in source order, and the bds main among them.
+  std::vector<const Stmt *> functions;
+  const Stmt *entry = nullptr;
+
+  // Resolves statements, reporting to diagnostics. Nothing can be lowered
+  // unless they resolve.
+  Program(std::span<Stmt *const> statements, Diagnostics &diagnostics);
+
+  auto shards() const -> size_t;
+  // Lowers every shard on up to threads threads, naming values only if
+  // names is set. Errors are reported to diagnostics shard by shard, in
+  // order.
+  auto compile(Diagnostics &diagnostics, std::string_view name,
+               unsigned threads, bool names = true) const
+      -> std::vector<std::unique_ptr<Compiler>>;
+};
+
+// Lowers a shard of a program to LLVM IR. Every bds value is an i64: numbers
+// are doubles, and nil, booleans and strings are boxed in quiet NaNs that
+// arithmetic never produces, so values need no memory of their own. Locals
+// live in allocas in the entry block of their function for mem2reg to
+// promote, and top-level variables in globals. Top-level functions become
+// functions of the same name prefixed with "bds.", and the top-level
+// statements become the C main, which calls the bds main if there is one.
+// Functions and variables of other shards are declared as they are used,
+// and top-level variables are only visible outside their module when there
+// are other shards to use them.
+// Operators check the types of their operands at run time and the runtime
+// they call into is emitted into the module itself, so the module only needs
+// the C library.
+//
+// Functions nested in other functions can be called, but cannot use the
+// variables of the functions around them, and functions are not values.
+// Anything that cannot be lowered is reported to diagnostics.
 struct Compiler {
-  auto compile(std::vector<std::unique_ptr<Stmt>> statements) -> void;
+  static constexpr uint64_t quietNaN = 0x7ffc000000000000;
+  static constexpr uint64_t signBit = 0x8000000000000000;
+  static constexpr uint64_t nil = quietNaN | 1;
+  static constexpr uint64_t falseValue = quietNaN | 2;
+  static constexpr uint64_t trueValue = quietNaN | 3;
+  static constexpr uint64_t stringTag = signBit | quietNaN;
+
+  // What a name is bound to: a variable's storage or a function.
+  struct Slot {
+    llvm::Value *variable = nullptr;
+    llvm::Function *function = nullptr;
+  };
+
+  // The slots of a scope begin at base. Only a function's own scope is a
+  // function scope.
+  struct Scope {
+    size_t base;
+    bool function;
+  };
+
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::unique_ptr<llvm::Module> module;
+  llvm::IRBuilder<> builder;
+  Diagnostics &diagnostics;
+  const Program &program;
+  const Resolution &resolution;
+  size_t shard;
+
+  std::vector<Slot> globals;
+  std::vector<Slot> slots;
+  std::vector<Scope> scopes;
+  // Where a break in each enclosing loop of the current function goes.
+  std::vector<llvm::BasicBlock *> loops;
+  // String literals by symbol, and runtime error messages.
+  std::vector<llvm::Constant *> strings;
+  std::unordered_map<std::string_view, llvm::Constant *> messages;
+  llvm::Function *printFunction = nullptr;
+  llvm::Function *failFunction = nullptr;
+  llvm::Constant *filename = nullptr;
+
+  // The block every failed check of the current function branches to, with
+  // the message and location of the check that failed.
+  struct Failure {
+    llvm::BasicBlock *block = nullptr;
+    llvm::PHINode *message = nullptr;
+    llvm::PHINode *row = nullptr;
+    llvm::PHINode *column = nullptr;
+  };
+  Failure failure;
+
+  // The node being lowered, for the overloads that look up what the
+  // resolver found for it.
+  const Expr *currentExpr = nullptr;
+  const Stmt *currentStmt = nullptr;
+
+  // Lowering recurses once per level of nesting. Once a thread has used
+  // stackBudget bytes of its stack, the rest of the subtree is lowered on a
+  // new thread with a stack of its own, so that nesting is only limited by
+  // the parser. If that thread does not finish, the error is reported at
+  // the first token of node.
+  static constexpr size_t stackBudget = 1 << 20;
+  static constexpr unsigned threadStack = 4 << 20;
+  std::uintptr_t stackBase = 0;
+
+  Compiler(Diagnostics &diagnostics, const Program &program, size_t shard = 0,
+           std::string_view name = "bds");
+
+  // Lowers the shard into module.
+  auto compile() -> void;
 
   auto codegen(const Expr &expr) -> llvm::Value *;
   auto codegen(const Stmt &stmt) -> llvm::Value *;
@@ -37,6 +169,40 @@ struct Compiler {
   auto codegen(const Stmt::Return &stmt) -> llvm::Value *;
   auto codegen(const Stmt::Var &stmt) -> llvm::Value *;
   auto codegen(const Stmt::While &stmt) -> llvm::Value *;
+
+  auto withStack(std::variant<const Expr *, const Stmt *> node,
+                 llvm::function_ref<llvm::Value *()> lower) -> llvm::Value *;
+  auto declare(const Stmt::Function &stmt,
+               llvm::GlobalValue::LinkageTypes linkage) -> llvm::Function *;
+  auto define(const Stmt *owner, const Stmt::Function &stmt,
+              llvm::Function *function) -> void;
+  auto declareRuntime() -> void;
+
+  // The slot of a global, declared or defined on first use.
+  auto global(uint32_t index) -> Slot &;
+  auto open(const Stmt *owner, bool function) -> void;
+  auto close() -> void;
+  // The slot binding refers to, or null if it is a variable of an enclosing
+  // function.
+  auto slot(Binding binding, const Token &name) -> Slot *;
+  auto variable(const Expr *use, const Token &name) -> llvm::Value *;
+  auto allocate(const Token &name) -> llvm::Value *;
+
+  auto constant(uint64_t value) -> llvm::Constant *;
+  auto boolean(llvm::Value *condition) -> llvm::Value *;
+  auto truthy(llvm::Value *value) -> llvm::Value *;
+  auto isNumber(llvm::Value *value) -> llvm::Value *;
+  auto toNumber(llvm::Value *value) -> llvm::Value *;
+  auto fromNumber(llvm::Value *value) -> llvm::Value *;
+  auto string(const Token &token) -> llvm::Value *;
+  // Fails at run time with message at token unless condition holds.
+  auto check(llvm::Value *condition, std::string_view message,
+             const Token &token) -> void;
+  // Starts a block for the code after a return or break, which nothing
+  // branches to.
+  auto unreachable() -> void;
+  auto report(Error::Type type, const Token &token, std::string arg = {})
+      -> llvm::Value *;
 };
 
-#endif // CODEGEN_HPP
\ No newline at end of file
+#endif // CODEGEN_HPP
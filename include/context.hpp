@@ -0,0 +1,67 @@
+#ifndef CONTEXT_HPP
+#define CONTEXT_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Owns every AST node. Nodes are bump-allocated out of large chunks and are
+// never destroyed individually, so they must be trivially destructible; the
+// whole tree goes away with the context, one chunk at a time.
+class ASTContext {
+  std::vector<std::unique_ptr<std::byte[]>> chunks;
+  std::byte *cursor = nullptr;
+  std::byte *limit = nullptr;
+  size_t chunkSize = 64 << 10;
+  size_t used = 0;
+
+  auto grow(size_t size) -> void;
+
+public:
+  ASTContext() = default;
+  ASTContext(const ASTContext &) = delete;
+  ASTContext(ASTContext &&) = default;
+  auto operator=(ASTContext &&) -> ASTContext & = default;
+
+  auto allocate(size_t size, size_t align) -> void * {
+    auto space = static_cast<size_t>(limit - cursor);
+    void *p = cursor;
+    if (!std::align(align, size, p, space)) {
+      grow(size + align);
+      p = cursor;
+      space = limit - cursor;
+      std::align(align, size, p, space);
+    }
+    cursor = static_cast<std::byte *>(p) + size;
+    used += size;
+    return p;
+  }
+
+  template <class T, class... Args> auto create(Args &&...args) -> T * {
+    static_assert(std::is_trivially_destructible_v<T>);
+    return new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+
+  template <class T> auto copy(std::span<const T> items) -> std::span<T> {
+    static_assert(std::is_trivially_destructible_v<T>);
+    if (items.empty())
+      return {};
+
+    auto *p = static_cast<T *>(allocate(items.size_bytes(), alignof(T)));
+    std::uninitialized_copy(items.begin(), items.end(), p);
+    return {p, items.size()};
+  }
+
+  // Takes over the chunks of another context, so that nodes allocated there
+  // live as long as this one. Allocation carries on in the current chunk.
+  auto merge(ASTContext &&other) -> void;
+
+  auto bytes() const -> size_t { return used; }
+};
+
+#endif // CONTEXT_HPP
@@ -0,0 +1,53 @@
+#ifndef DIAGNOSTICS_HPP
+#define DIAGNOSTICS_HPP
+
+#include <error.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Collects the errors of a run so that the lexer and parser can recover and
+// keep going, then renders them all at once in source order. Once limit
+// errors have been reported it is full, and the lexer and parser stop; only
+// the first limit errors in source order are rendered.
+class Diagnostics {
+  std::vector<Error> errors;
+  size_t errorLimit;
+  bool unterminated = false;
+
+  auto sorted() const -> std::vector<const Error *>;
+
+public:
+  enum class Format { Text, Json };
+
+  static constexpr size_t defaultLimit = 100;
+
+  // A limit of 0 collects every error.
+  explicit Diagnostics(size_t limit = defaultLimit) : errorLimit(limit) {}
+
+  static auto parse(std::string_view name) -> std::optional<Format>;
+
+  auto report(Error error) -> void;
+  // Adds the errors of a pass that ran separately, such as lexing ahead of
+  // the parser. Each pass found every error up to the point where it
+  // stopped, so the first limit errors of both are still the first limit
+  // errors of the input.
+  auto merge(Diagnostics &&other) -> void;
+  auto limit() const -> size_t { return errorLimit; }
+  auto full() const -> bool {
+    return errorLimit && errors.size() >= errorLimit;
+  }
+  auto empty() const -> bool { return errors.empty(); }
+  auto size() const -> size_t {
+    return errorLimit ? std::min(errors.size(), errorLimit) : errors.size();
+  }
+
+  auto print(Format format) const -> void;
+  auto json() const -> std::string;
+};
+
+#endif // DIAGNOSTICS_HPP
@@ -4,6 +4,7 @@
 #include <token.hpp>
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 struct Error {
@@ -15,11 +16,21 @@ struct Error {
     InvalidAssignment,
     TooManyArguments,
     TooManyParameters,
+    NestingTooDeep,
+    UndefinedVariable,
+    UseBeforeDefinition,
+    NotCallable,
+    ArityMismatch,
+    BreakOutsideLoop,
+    ReturnOutsideFunction,
+    Unsupported,
+    InvalidEdit,
   } type;
   Token token;
   std::vector<std::string> args;
 
-  auto print() -> void;
+  auto message() const -> std::string_view;
+  auto print() const -> void;
 };
 
 #endif // ERROR_HPP
\ No newline at end of file
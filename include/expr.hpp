@@ -3,53 +3,48 @@
 
 #include <token.hpp>
 
-#include <memory>
+#include <span>
+#include <type_traits>
 #include <variant>
-#include <vector>
 
 struct Expr {
 
   struct Assign {
     Token name;
-    std::unique_ptr<Expr> value;
+    Expr *value;
 
-    Assign(Token name, std::unique_ptr<Expr> value)
-        : name(std::move(name)), value(std::move(value)) {}
+    Assign(Token name, Expr *value) : name(std::move(name)), value(value) {}
   };
 
   struct Binary {
-    std::unique_ptr<Expr> left;
+    Expr *left;
     Token op;
-    std::unique_ptr<Expr> right;
+    Expr *right;
 
-    Binary(std::unique_ptr<Expr> left, Token op, std::unique_ptr<Expr> right)
-        : left(std::move(left)), op(std::move(op)), right(std::move(right)) {}
+    Binary(Expr *left, Token op, Expr *right)
+        : left(left), op(std::move(op)), right(right) {}
   };
 
   struct Call {
-    std::unique_ptr<Expr> callee;
+    Expr *callee;
     Token paren;
-    std::vector<std::unique_ptr<Expr>> arguments;
+    std::span<Expr *> arguments;
 
-    Call(std::unique_ptr<Expr> callee, Token paren,
-         std::vector<std::unique_ptr<Expr>> arguments)
-        : callee(std::move(callee)), paren(std::move(paren)),
-          arguments(std::move(arguments)) {}
+    Call(Expr *callee, Token paren, std::span<Expr *> arguments)
+        : callee(callee), paren(std::move(paren)), arguments(arguments) {}
   };
 
   struct Get {
-    std::unique_ptr<Expr> object;
+    Expr *object;
     Token name;
 
-    Get(std::unique_ptr<Expr> object, Token name)
-        : object(std::move(object)), name(std::move(name)) {}
+    Get(Expr *object, Token name) : object(object), name(std::move(name)) {}
   };
 
   struct Grouping {
-    std::unique_ptr<Expr> expression;
+    Expr *expression;
 
-    Grouping(std::unique_ptr<Expr> expression)
-        : expression(std::move(expression)) {}
+    Grouping(Expr *expression) : expression(expression) {}
   };
 
   struct Literal {
@@ -59,22 +54,21 @@ struct Expr {
   };
 
   struct Logical {
-    std::unique_ptr<Expr> left;
+    Expr *left;
     Token op;
-    std::unique_ptr<Expr> right;
+    Expr *right;
 
-    Logical(std::unique_ptr<Expr> left, Token op, std::unique_ptr<Expr> right)
-        : left(std::move(left)), op(std::move(op)), right(std::move(right)) {}
+    Logical(Expr *left, Token op, Expr *right)
+        : left(left), op(std::move(op)), right(right) {}
   };
 
   struct Set {
-    std::unique_ptr<Expr> object;
+    Expr *object;
     Token name;
-    std::unique_ptr<Expr> value;
+    Expr *value;
 
-    Set(std::unique_ptr<Expr> object, Token name, std::unique_ptr<Expr> value)
-        : object(std::move(object)), name(std::move(name)),
-          value(std::move(value)) {}
+    Set(Expr *object, Token name, Expr *value)
+        : object(object), name(std::move(name)), value(value) {}
   };
 
   struct This {
@@ -85,10 +79,9 @@ struct Expr {
 
   struct Unary {
     Token op;
-    std::unique_ptr<Expr> right;
+    Expr *right;
 
-    Unary(Token op, std::unique_ptr<Expr> right)
-        : op(std::move(op)), right(std::move(right)) {}
+    Unary(Token op, Expr *right) : op(std::move(op)), right(right) {}
   };
 
   struct Variable {
@@ -118,7 +111,9 @@ struct Expr {
     return std::visit(visitor, expr);
   }
 
-  template <class T> auto get() -> T * { return &std::get<T>(expr); }
+  template <class T> auto get() -> T * { return std::get_if<T>(&expr); }
 };
 
+static_assert(std::is_trivially_destructible_v<Expr>);
+
 #endif // EXPR_HPP
\ No newline at end of file
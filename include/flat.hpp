@@ -0,0 +1,99 @@
+#ifndef FLAT_HPP
+#define FLAT_HPP
+
+#include <expr.hpp>
+#include <stmt.hpp>
+#include <token.hpp>
+
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+using NodeId = uint32_t;
+
+// The AST as parallel tables indexed by NodeId. Every node has a kind, the
+// index of its main token and two data words whose meaning depends on the
+// kind; lists of children live in extra. Nodes are stored children first,
+// so a linear pass over the tables visits each subtree before its parent.
+//
+//   Assign      token name     lhs value
+//   Binary      token op       lhs left       rhs right
+//   Call        token paren    lhs callee     rhs extra: count, arguments...
+//   Get         token name     lhs object
+//   Grouping                   lhs expression
+//   Literal     token value
+//   Logical     token op       lhs left       rhs right
+//   Set         token name     lhs object     rhs value
+//   This        token keyword
+//   Unary       token op       lhs right
+//   Variable    token name
+//   Block                      lhs extra begin  rhs extra end
+//   Break       token keyword
+//   Expression                 lhs expression
+//   Function    token name     lhs extra: count, param tokens...  rhs body
+//   If                         lhs condition  rhs extra: then, else
+//   Print                      lhs expression
+//   Return      token keyword  lhs value
+//   Var         token name     lhs initializer
+//   While                      lhs condition  rhs body
+class FlatAST {
+public:
+  enum class Kind : uint8_t {
+    Assign,
+    Binary,
+    Call,
+    Get,
+    Grouping,
+    Literal,
+    Logical,
+    Set,
+    This,
+    Unary,
+    Variable,
+    Block,
+    Break,
+    Expression,
+    Function,
+    If,
+    Print,
+    Return,
+    Var,
+    While,
+  };
+
+  static constexpr NodeId none = std::numeric_limits<NodeId>::max();
+
+  std::vector<Kind> kinds;
+  std::vector<uint32_t> tokenIndices;
+  std::vector<uint32_t> lhs;
+  std::vector<uint32_t> rhs;
+  std::vector<uint32_t> extra;
+  std::vector<Token> tokens;
+  std::vector<NodeId> roots;
+
+  static auto build(std::span<Stmt *const> statements) -> FlatAST;
+
+  auto size() const -> size_t { return kinds.size(); }
+  auto kind(NodeId node) const -> Kind { return kinds[node]; }
+  auto token(NodeId node) const -> const Token & {
+    return tokens[tokenIndices[node]];
+  }
+
+  // Children of a Block, or the arguments of a Call.
+  auto list(NodeId node) const -> std::span<const uint32_t>;
+  // Parameter token indices of a Function.
+  auto params(NodeId node) const -> std::span<const uint32_t>;
+
+  auto add(Kind kind, uint32_t token, uint32_t lhs = none, uint32_t rhs = none)
+      -> NodeId;
+  auto addToken(const Token &token) -> uint32_t;
+
+  // Calls f(node, kind) for every node in storage order.
+  template <class F> auto walk(F &&f) const -> void {
+    for (NodeId node = 0; node < kinds.size(); node++)
+      f(node, kinds[node]);
+  }
+};
+
+#endif // FLAT_HPP
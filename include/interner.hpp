@@ -0,0 +1,74 @@
+#ifndef INTERNER_HPP
+#define INTERNER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using Symbol = uint32_t;
+
+// Maps the text of every identifier and string literal to a Symbol, so that
+// later passes compare and look up names as integers. Each distinct text is
+// stored once and its symbol stays valid for the whole run. Lexers interning
+// on several threads at once contend only when their texts hash to the same
+// shard. Symbols are numbered from zero across all shards in the order their
+// texts were first seen, so tables indexed by symbol stay as small as the
+// number of distinct texts.
+class Interner {
+  static constexpr unsigned shardBits = 4;
+
+  // A text with its hash, which also picks the shard, so that it is hashed
+  // once per lookup.
+  struct Key {
+    std::string_view text;
+    size_t hash;
+
+    auto operator==(const Key &other) const -> bool {
+      return text == other.text;
+    }
+  };
+
+  struct Hash {
+    auto operator()(const Key &key) const -> size_t { return key.hash; }
+  };
+
+  struct Shard {
+    mutable std::mutex mutex;
+    std::unordered_map<Key, Symbol, Hash> symbols;
+    std::deque<std::string> texts;
+  };
+
+  std::array<Shard, 1 << shardBits> shards;
+  std::atomic<Symbol> next = 0;
+  // The text of each symbol, in chunks that are never moved: chunk i holds
+  // the 2^i symbols from 2^i - 1 on, and is allocated when first needed.
+  std::array<std::atomic<std::string_view *>, 32> chunks{};
+
+  static auto key(std::string_view text) -> Key;
+  auto chunk(size_t index) -> std::string_view *;
+
+public:
+  static constexpr Symbol none = std::numeric_limits<Symbol>::max();
+
+  Interner() = default;
+  Interner(const Interner &) = delete;
+  auto operator=(const Interner &) -> Interner & = delete;
+  ~Interner();
+
+  static auto instance() -> Interner &;
+
+  auto intern(std::string_view text) -> Symbol;
+  // The symbol of text if it was ever interned, none otherwise.
+  auto find(std::string_view text) const -> Symbol;
+  auto text(Symbol symbol) const -> std::string_view;
+  auto size() const -> size_t;
+};
+
+#endif // INTERNER_HPP
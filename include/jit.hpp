@@ -0,0 +1,34 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <backend.hpp>
+#include <codegen.hpp>
+#include <optimizer.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <expected>
+#include <memory>
+#include <span>
+#include <string>
+
+// Runs a program's C main in this process with ORC's lazy JIT, for the CPU
+// and features of a backend. Every function starts as a stub, and is only
+// optimized and compiled the first time it is called, on its own. The C
+// library the runtime calls into is resolved in this process.
+struct Jit {
+  Optimizer &optimizer;
+  // When main was entered, and how many of the program's functions were
+  // compiled by the time it returned.
+  std::chrono::steady_clock::time_point entered;
+  size_t functions = 0;
+  size_t compiled = 0;
+
+  // The status main returned. The contexts and modules of the shards are
+  // moved into the JIT, which leaves the compilers empty.
+  auto run(const Backend &backend,
+           std::span<std::unique_ptr<Compiler>> shards)
+      -> std::expected<int, std::string>;
+};
+
+#endif // JIT_HPP
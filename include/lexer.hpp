@@ -1,38 +1,67 @@
 #ifndef LEXER_HPP
 #define LEXER_HPP
 
+#include <diagnostics.hpp>
 #include <error.hpp>
 #include <token.hpp>
 
 #include <expected>
 #include <optional>
-#include <string>
 #include <string_view>
 #include <vector>
 
+struct Edit {
+  uint32_t offset;
+  uint32_t length;
+  std::string_view text;
+};
+
+struct Relex {
+  std::vector<Token> tokens;
+  size_t first;
+  size_t removed;
+  size_t inserted;
+};
+
 class Lexer {
-  std::string filename;
+  uint32_t file;
   std::string_view source;
-  std::vector<Token> tokens;
 
-  int start = 0;
-  int current = 0;
-  int row = 1;
-  int column = 1;
+  uint32_t start = 0;
+  uint32_t current = 0;
+  uint32_t limit = 0;
 
   auto isAtEnd() -> bool;
   auto advance() -> char;
   auto peek() -> char;
   auto peekNext() -> char;
-  auto getline() -> std::string;
-  auto getline(int n) -> std::string;
-  auto newToken(Token::Type type, std::string_view lexeme) -> Token;
+  auto cursor() -> const char *;
+  auto end() -> const char *;
+  auto seek(const char *position) -> void;
+  auto newToken(Token::Type type) -> Token;
+  auto newToken(Token::Type type, uint32_t offset, uint32_t length) -> Token;
   auto scanToken() -> std::expected<std::optional<Token>, Error>;
+  auto scanSequential(Diagnostics *diagnostics)
+      -> std::expected<std::vector<Token>, Error>;
+  auto scanParallel(unsigned threads, Diagnostics *diagnostics)
+      -> std::expected<std::vector<Token>, Error>;
 
 public:
-  Lexer(std::string_view filename, std::string_view source);
+  Lexer(uint32_t file);
+  Lexer(uint32_t file, uint32_t begin, uint32_t limit);
 
+  auto position() const -> uint32_t { return current; }
+
+  auto next() -> std::expected<Token, Error>;
   auto scanTokens() -> std::expected<std::vector<Token>, Error>;
+  auto scanTokens(unsigned threads) -> std::expected<std::vector<Token>, Error>;
+  // Reports every error to diagnostics, skipping the offending input, until
+  // it is full.
+  auto scanTokens(Diagnostics &diagnostics, unsigned threads = 1)
+      -> std::vector<Token>;
+
+  static auto relex(std::vector<Token> tokens, Edit edit)
+      -> std::expected<Relex, Error>;
 };
 
 #endif // LEXER_HPP
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef OPTIMIZER_HPP
+#define OPTIMIZER_HPP
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+// Runs LLVM's standard optimization pipeline for a level over a module with
+// the new pass manager, tuned the way clang tunes it. With printAfterAll the
+// module, function or loop each pass ran on is printed to standard error
+// after it. With timePasses the time of every pass and analysis is
+// collected, not counting the passes and analyses it ran in turn.
+struct Optimizer {
+  enum class Level { O0, O1, O2, O3, Os, Oz };
+
+  struct Timing {
+    std::string pass;
+    double milliseconds = 0;
+    size_t runs = 0;
+  };
+
+  Level level = Level::O0;
+  bool printAfterAll = false;
+  bool timePasses = false;
+  // Slowest first, over every run.
+  std::vector<Timing> timings;
+
+  // Levels are named as in -O: 0, 1, 2, 3, s and z.
+  static auto parse(std::string_view name) -> std::optional<Level>;
+  static auto name(Level level) -> std::string_view;
+
+  // With a target machine, passes use its cost model and features.
+  auto run(llvm::Module &module, llvm::TargetMachine *machine = nullptr)
+      -> void;
+  // Adds the timings of an optimizer that ran on other modules.
+  auto merge(const Optimizer &other) -> void;
+};
+
+#endif // OPTIMIZER_HPP
@@ -0,0 +1,40 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <diagnostics.hpp>
+#include <optimizer.hpp>
+#include <parser.hpp>
+#include <printer.hpp>
+
+#include <cstddef>
+#include <expected>
+#include <string>
+
+struct Options {
+  std::string filename;
+  bool stats = false;
+  unsigned threads = 1;
+  size_t maxNesting = Parser::defaultMaxDepth;
+  bool lazyBodies = false;
+  std::string cacheDir;
+  size_t errorLimit = Diagnostics::defaultLimit;
+  Diagnostics::Format diagnosticsFormat = Diagnostics::Format::Text;
+  Printer::Format astFormat = Printer::Format::SExpr;
+  bool emitLlvm = false;
+  Optimizer::Level optimization = Optimizer::Level::O0;
+  bool printAfterAll = false;
+  bool timePasses = false;
+  // -c and -S stop at an object or assembly file, and -o alone links an
+  // executable.
+  bool compileOnly = false;
+  bool assemblyOnly = false;
+  std::string output;
+  std::string cpu;
+  std::string features;
+  bool run = false;
+
+  static auto parse(int argc, const char *argv[])
+      -> std::expected<Options, std::string>;
+};
+
+#endif // OPTIONS_HPP
@@ -0,0 +1,60 @@
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Appends text to out as a quoted JSON string.
+auto escape(std::string &out, std::string_view text) -> void;
+
+// Collects text in one block and hands it to a stream whenever the block
+// fills, so that writing costs one call per block rather than one per line
+// and memory stays bounded however much is written. The stream itself is
+// only flushed by flush(). Without a stream the block starts empty and grows
+// to hold all the text instead, so that short texts stay cheap.
+class Output {
+  std::ostream *stream;
+  std::string buffer;
+  size_t used = 0;
+
+  // Makes room for size more bytes.
+  auto reserve(size_t size) -> void;
+  // Hands the block to the stream without flushing it.
+  auto drain() -> void;
+
+public:
+  static constexpr size_t blockSize = 1 << 16;
+
+  Output() : Output(nullptr) {}
+  explicit Output(std::ostream &stream) : Output(&stream) {}
+  Output(const Output &) = delete;
+  auto operator=(const Output &) -> Output & = delete;
+  ~Output() { flush(); }
+
+  auto write(std::string_view text) -> void {
+    if (buffer.size() - used < text.size())
+      reserve(text.size());
+    std::memcpy(buffer.data() + used, text.data(), text.size());
+    used += text.size();
+  }
+  auto write(char c) -> void {
+    if (used == buffer.size())
+      reserve(1);
+    buffer[used++] = c;
+  }
+  auto spaces(size_t count) -> void;
+  auto escaped(std::string_view text) -> void;
+  auto flush() -> void;
+
+  // Everything written, when there is no stream.
+  auto text() -> std::string;
+
+private:
+  explicit Output(std::ostream *stream)
+      : stream(stream), buffer(stream ? blockSize : 0, 0) {}
+};
+
+#endif // OUTPUT_HPP
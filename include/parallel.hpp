@@ -0,0 +1,29 @@
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <future>
+#include <vector>
+
+// Calls task(i) for every i below count on up to threads threads, the
+// calling thread among them. Each thread takes the next index as soon as it
+// is done with one, so that tasks of uneven size balance out.
+template <class Task>
+auto parallel(size_t count, unsigned threads, Task &&task) -> void {
+  std::atomic<size_t> next = 0;
+  auto work = [&] {
+    for (auto i = next++; i < count; i = next++)
+      task(i);
+  };
+
+  std::vector<std::future<void>> workers;
+  for (size_t i = 1; i < std::min<size_t>(threads, count); i++)
+    workers.push_back(std::async(std::launch::async, work));
+  work();
+  for (auto &worker : workers)
+    worker.get();
+}
+
+#endif // PARALLEL_HPP
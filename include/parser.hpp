@@ -1,21 +1,60 @@
 #ifndef PARSER_HPP
 #define PARSER_HPP
 
+#include <context.hpp>
+#include <diagnostics.hpp>
 #include <error.hpp>
 #include <expr.hpp>
+#include <lexer.hpp>
 #include <stmt.hpp>
 
+#include <array>
+#include <cstdint>
 #include <expected>
-#include <memory>
+#include <optional>
+#include <span>
 #include <string>
 #include <vector>
 
+// A function body that was only brace-matched, from its opening brace up to
+// end, and what Parser::body needs to parse it when it is first asked for.
+struct LazyBody {
+  Token brace;
+  uint32_t end;
+  bool failed = false;
+  size_t maxDepth;
+  ASTContext *context;
+  Diagnostics *diagnostics;
+};
+
 class Parser {
-  std::string filename;
+  Lexer *lexer = nullptr;
   std::vector<Token> tokens;
-  std::vector<std::unique_ptr<Stmt>> statements;
+  // The tokens being parsed, and the token that follows the last of them.
+  std::span<const Token> view;
+  Token end;
+  std::optional<Error> lexError;
+  Diagnostics *diagnostics = nullptr;
+  // The lexer runs ahead of the parser, so its errors are kept apart and
+  // merged into diagnostics once parsing stops.
+  Diagnostics lexDiagnostics;
+  ASTContext *context;
+  std::vector<Stmt *> statements;
+
+  // Lists are collected on these stacks and copied into the context once
+  // complete; nested lists finish first, so they only ever grow at the top.
+  std::vector<Stmt *> stmtStack;
+  std::vector<Expr *> exprStack;
+  std::vector<Token> paramStack;
+
+  // The parser never looks further than one token behind or ahead of
+  // current, so only that window is kept, indexed by absolute position.
+  std::array<Token, 4> window;
+  size_t fetched = 0;
+  size_t current = 0;
 
-  int current = 0;
+  auto fetch() -> Token;
+  auto at(size_t index) -> Token;
 
   auto isAtEnd() -> bool;
   auto advance() -> Token;
@@ -27,39 +66,97 @@ class Parser {
   auto consume(Token::Type type) -> std::expected<Token, Error>;
   auto synchronize() -> void;
 
-  auto expression() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto assignment() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto logicalOr() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto logicalAnd() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto equality() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto comparison() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto addition() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto multiplication() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto unary() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto call() -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto finishCall(std::unique_ptr<Expr> callee)
-      -> std::expected<std::unique_ptr<Expr>, Error>;
-  auto primary() -> std::expected<std::unique_ptr<Expr>, Error>;
-
-  auto declaration() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto varDeclaration() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto statement() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto printStatement() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto expressionStatement() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto block() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto ifStatement() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto whileStatement() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto forStatement() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto breakStatement() -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto function(std::string kind)
-      -> std::expected<std::unique_ptr<Stmt>, Error>;
-  auto returnStatement() -> std::expected<std::unique_ptr<Stmt>, Error>;
+  enum Precedence : uint8_t {
+    None,
+    Assignment,
+    Or,
+    And,
+    Equality,
+    Comparison,
+    Term,
+    Factor,
+    Unary,
+    Call,
+  };
+
+  // Binding power of each token used as an infix or call operator; None for
+  // every other token.
+  static const std::array<Precedence, size_t(Token::Type::END) + 1>
+      infixPrecedence;
+
+  // Expressions and statements are parsed without recursion: every
+  // construct that is still waiting for an operand or a body is a frame on
+  // one of these stacks, and their combined size is the nesting depth.
+  struct ExprFrame {
+    enum Kind : uint8_t { Unary, Grouping, Binary, Assign, Call } kind;
+    Precedence precedence;
+    Token op;
+    Expr *left;
+    size_t base;
+  };
+
+  struct StmtFrame {
+    enum Kind : uint8_t { Block, If, Else, While, Function } kind;
+    Token name;
+    Expr *condition;
+    Stmt *thenBranch;
+    std::span<Token> params;
+    size_t base;
+  };
+
+  std::vector<ExprFrame> exprFrames;
+  std::vector<StmtFrame> stmtFrames;
+  size_t maxDepth;
+  bool lazyBodies;
+
+  auto nest(Token token) -> std::expected<void, Error>;
+  auto skipBody(Token name, std::span<Token> params)
+      -> std::expected<Stmt *, Error>;
+
+  auto parseSequential() -> std::expected<std::vector<Stmt *>, Error>;
+  auto parseParallel(unsigned threads)
+      -> std::expected<std::vector<Stmt *>, Error>;
+
+  auto expression() -> std::expected<Expr *, Error>;
+  auto finishCall(ExprFrame &frame, Expr *argument)
+      -> std::expected<Expr *, Error>;
+
+  auto declaration() -> std::expected<Stmt *, Error>;
+  auto resumeDeclaration(size_t bottom) -> std::expected<Stmt *, Error>;
+  auto condition() -> std::expected<Expr *, Error>;
+  auto parameters() -> std::expected<std::span<Token>, Error>;
+  auto varDeclaration() -> std::expected<Stmt *, Error>;
+  auto printStatement() -> std::expected<Stmt *, Error>;
+  auto expressionStatement() -> std::expected<Stmt *, Error>;
+  auto forStatement() -> std::expected<Stmt *, Error>;
+  auto breakStatement() -> std::expected<Stmt *, Error>;
+  auto returnStatement() -> std::expected<Stmt *, Error>;
+
+  Parser(std::span<const Token> tokens, Token end, ASTContext &context,
+         size_t maxDepth, bool lazyBodies);
 
 public:
-  Parser(std::string_view filename, std::vector<Token> tokens);
+  static constexpr size_t defaultMaxDepth = 10000;
+
+  // With lazyBodies, the braced bodies of top-level functions are only
+  // brace-matched; errors inside them are found when they are parsed.
+  Parser(Lexer &lexer, ASTContext &context,
+         size_t maxDepth = defaultMaxDepth, bool lazyBodies = false);
+  Parser(std::vector<Token> tokens, ASTContext &context,
+         size_t maxDepth = defaultMaxDepth, bool lazyBodies = false);
+
+  auto parseTokens() -> std::expected<std::vector<Stmt *>, Error>;
+  auto parseTokens(unsigned threads)
+      -> std::expected<std::vector<Stmt *>, Error>;
+  // Reports every error to diagnostics and recovers from it, until they are
+  // full, and returns whatever was parsed.
+  auto parseTokens(Diagnostics &diagnostics, unsigned threads = 1)
+      -> std::vector<Stmt *>;
 
-  auto parseTokens()
-      -> std::expected<std::vector<std::unique_ptr<Stmt>>, Error>;
+  // The body of a function, parsing it first if it was skipped. Returns null
+  // if it does not parse; the error goes to the diagnostics the function was
+  // parsed with, if any. Not thread-safe.
+  static auto body(const Stmt::Function &function) -> Stmt *;
 };
 
 #endif // PARSER_HPP
\ No newline at end of file
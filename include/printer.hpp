@@ -2,38 +2,155 @@
 #define PRINTER_HPP
 
 #include <expr.hpp>
+#include <flat.hpp>
+#include <output.hpp>
 #include <stmt.hpp>
 
-#include <memory>
+#include <cstddef>
+#include <initializer_list>
+#include <iostream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <variant>
 #include <vector>
 
+// Prints the AST as s-expressions, JSON or an indented tree, straight into one
+// buffered output. Nodes are expanded on an explicit stack into pieces that
+// say where a node begins and ends, what its tokens and children are called,
+// and where lists of them begin and end, and each format renders the pieces
+// as they come off the stack. Arbitrarily deep trees therefore print without
+// recursion, in time linear in the output. A missing child prints as
+// nothing, or as null in JSON. Tree lines stop indenting maxIndent levels
+// down and are prefixed with their depth instead, so that deep trees do not
+// print quadratically many spaces.
 struct Printer {
-  auto print(std::vector<std::unique_ptr<Stmt>> statements) -> void;
+  enum class Format { SExpr, Json, Tree };
+
+  static constexpr size_t maxIndent = 64;
+
+  struct Begin {
+    std::string_view kind;
+  };
+  struct Field {
+    const char *label;
+    std::string_view text;
+  };
+  // A node and what it is called in its parent. Top-level statements and the
+  // nodes of a list have no label.
+  template <class T> struct Child {
+    const char *label;
+    T node;
+  };
+  // A list of child nodes, or of words when it lists tokens.
+  struct List {
+    const char *label;
+    bool words;
+  };
+  struct Word {
+    std::string_view text;
+    bool last;
+  };
+  // Follows each node of a list.
+  struct Item {
+    bool last;
+  };
+  struct EndList {
+    bool words;
+  };
+  struct End {};
+
+  using Piece = std::variant<Begin, Field, List, Word, Item, EndList, End,
+                             Child<const Expr *>, Child<const Stmt *>>;
+  using FlatPiece =
+      std::variant<Begin, Field, List, Word, Item, EndList, End, Child<NodeId>>;
+
+  Format format;
+  Output *out = nullptr;
+  size_t depth = 0;
+  // Whether the line of the innermost open node is still being written.
+  bool lineOpen = false;
+  std::vector<Piece> pieces;
+  std::vector<FlatPiece> flatPieces;
+
+  explicit Printer(Format format = Format::SExpr) : format(format) {}
+
+  static auto parse(std::string_view name) -> std::optional<Format>;
+
+  auto print(std::span<Stmt *const> statements,
+             std::ostream &stream = std::cout) -> void;
+  auto print(const FlatAST &ast, std::ostream &stream = std::cout) -> void;
 
   auto to_string(const Expr &expr) -> std::string;
   auto to_string(const Stmt &stmt) -> std::string;
+  auto to_string(const FlatAST &ast, NodeId node) -> std::string;
+
+  auto write(Piece root) -> void;
+  auto write(const FlatAST &ast, NodeId root) -> void;
+
+  static auto child(const char *label, const Expr *node)
+      -> Child<const Expr *> {
+    return {label, node};
+  }
+  static auto child(const char *label, const Stmt *node)
+      -> Child<const Stmt *> {
+    return {label, node};
+  }
+  static auto child(const char *label, NodeId node) -> Child<NodeId> {
+    return {label, node};
+  }
+
+  // Write what comes around the top-level statements and around each one.
+  auto open() -> void;
+  auto before(bool first) -> void;
+  auto after() -> void;
+  auto close() -> void;
+
+  auto render(const Begin &piece) -> void;
+  auto render(const Field &piece) -> void;
+  auto render(const List &piece) -> void;
+  auto render(const Word &piece) -> void;
+  auto render(const Item &piece) -> void;
+  auto render(const EndList &piece) -> void;
+  auto render(const End &piece) -> void;
+  // Write what comes before a child with the given label, and a missing
+  // child.
+  auto key(const char *label) -> void;
+  auto missing() -> void;
+  auto indent() -> void;
+
+  // Schedules pieces to be written in the order given.
+  auto push(std::initializer_list<Piece> list) -> void;
+  auto pushFlat(std::initializer_list<FlatPiece> list) -> void;
+  // Writes the pieces of a node up to its first child and schedules the
+  // rest on stack.
+  template <class P, class... Parts>
+  auto emit(std::vector<P> &stack, const Parts &...parts) -> void;
+
+  auto expand(const Expr::Assign &expr) -> void;
+  auto expand(const Expr::Binary &expr) -> void;
+  auto expand(const Expr::Call &expr) -> void;
+  auto expand(const Expr::Get &expr) -> void;
+  auto expand(const Expr::Grouping &expr) -> void;
+  auto expand(const Expr::Literal &expr) -> void;
+  auto expand(const Expr::Logical &expr) -> void;
+  auto expand(const Expr::Set &expr) -> void;
+  auto expand(const Expr::This &expr) -> void;
+  auto expand(const Expr::Unary &expr) -> void;
+  auto expand(const Expr::Variable &expr) -> void;
+
+  auto expand(const Stmt::Block &stmt) -> void;
+  auto expand(const Stmt::Break &stmt) -> void;
+  auto expand(const Stmt::Expression &stmt) -> void;
+  auto expand(const Stmt::Function &stmt) -> void;
+  auto expand(const Stmt::If &stmt) -> void;
+  auto expand(const Stmt::Print &stmt) -> void;
+  auto expand(const Stmt::Return &stmt) -> void;
+  auto expand(const Stmt::Var &stmt) -> void;
+  auto expand(const Stmt::While &stmt) -> void;
 
-  auto to_string(const Expr::Assign &expr) -> std::string;
-  auto to_string(const Expr::Binary &expr) -> std::string;
-  auto to_string(const Expr::Call &expr) -> std::string;
-  auto to_string(const Expr::Get &expr) -> std::string;
-  auto to_string(const Expr::Grouping &expr) -> std::string;
-  auto to_string(const Expr::Literal &expr) -> std::string;
-  auto to_string(const Expr::Logical &expr) -> std::string;
-  auto to_string(const Expr::Set &expr) -> std::string;
-  auto to_string(const Expr::This &expr) -> std::string;
-  auto to_string(const Expr::Unary &expr) -> std::string;
-  auto to_string(const Expr::Variable &expr) -> std::string;
-
-  auto to_string(const Stmt::Block &stmt) -> std::string;
-  auto to_string(const Stmt::Break &stmt) -> std::string;
-  auto to_string(const Stmt::Expression &stmt) -> std::string;
-  auto to_string(const Stmt::Function &stmt) -> std::string;
-  auto to_string(const Stmt::If &stmt) -> std::string;
-  auto to_string(const Stmt::Print &stmt) -> std::string;
-  auto to_string(const Stmt::Return &stmt) -> std::string;
-  auto to_string(const Stmt::Var &stmt) -> std::string;
-  auto to_string(const Stmt::While &stmt) -> std::string;
+  auto expand(const FlatAST &ast, NodeId node) -> void;
 };
 
-#endif // PRINTER_HPP
\ No newline at end of file
+#endif // PRINTER_HPP
@@ -0,0 +1,42 @@
+#ifndef RESOLVER_HPP
+#define RESOLVER_HPP
+
+#include <diagnostics.hpp>
+#include <expr.hpp>
+#include <stmt.hpp>
+
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+
+// Where a variable lives. A local is a slot of the scope depth scopes out
+// from the one it is used in. A global is an index into the top-level
+// variables and functions of the program.
+struct Binding {
+  enum class Kind : uint8_t { Local, Global };
+
+  Kind kind;
+  uint32_t depth;
+  uint32_t index;
+};
+
+// What resolving a program found, kept beside the AST rather than in it: the
+// binding of every variable use and assignment, the binding each variable and
+// function declaration introduces, and the number of slots of each scope,
+// keyed by the block or function that opens it. A function's parameters and
+// the top level of its body share one scope.
+struct Resolution {
+  std::unordered_map<const Expr *, Binding> uses;
+  std::unordered_map<const Stmt *, Binding> declarations;
+  std::unordered_map<const Stmt *, uint32_t> slots;
+  uint32_t globals = 0;
+};
+
+// Binds every use of a name to its declaration, without recursion, and
+// reports the uses it cannot bind. Top-level functions can be used anywhere,
+// but code outside any function cannot read a top-level variable before its
+// declaration has run, and no variable can be read in its own initializer.
+auto resolve(std::span<Stmt *const> statements, Diagnostics &diagnostics)
+    -> Resolution;
+
+#endif // RESOLVER_HPP
@@ -0,0 +1,29 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <string_view>
+
+// Kernels that skip a run of bytes for the lexer. Each returns a pointer to
+// the first byte in [p, end) that ends the run, or end if there is none.
+// SSE2 and AVX2 variants are selected at startup; the scalar ones are the
+// reference they must agree with.
+namespace scan {
+
+enum class Isa { Scalar, SSE2, AVX2 };
+
+auto isa() -> Isa;
+auto setIsa(Isa isa) -> bool;
+auto name(Isa isa) -> std::string_view;
+
+// First byte that is not ' ', '\t', '\r' or '\n'.
+auto whitespace(const char *p, const char *end) -> const char *;
+// First byte that is not [A-Za-z0-9_].
+auto identifier(const char *p, const char *end) -> const char *;
+// First occurrence of c.
+auto find(const char *p, const char *end, char c) -> const char *;
+// First '*' that is followed by '/'.
+auto commentEnd(const char *p, const char *end) -> const char *;
+
+} // namespace scan
+
+#endif // SCAN_HPP
@@ -0,0 +1,51 @@
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct Source {
+  std::string filename;
+  std::string buffer;
+  std::string_view text;
+  std::vector<uint32_t> lines;
+  void *mapping = nullptr;
+
+  Source(std::string_view filename, std::string buffer);
+  Source(std::string_view filename, void *mapping, size_t size);
+  Source(const Source &) = delete;
+  ~Source();
+
+  auto row(uint32_t offset) const -> int;
+  auto line(int row) const -> std::string_view;
+  auto replace(uint32_t offset, uint32_t length, std::string_view text)
+      -> void;
+
+private:
+  auto index() -> void;
+};
+
+class SourceManager {
+  std::deque<Source> sources;
+
+public:
+  // Tokens keep the id of their source in sixteen bits.
+  static constexpr size_t maxSources = 1 << 16;
+
+  static auto instance() -> SourceManager &;
+
+  // Both fail once maxSources sources are held, and load when the file
+  // cannot be read.
+  auto add(std::string_view filename, std::string buffer)
+      -> std::optional<uint32_t>;
+  auto load(std::string_view filename) -> std::optional<uint32_t>;
+  auto get(uint32_t file) const -> const Source &;
+  auto get(uint32_t file) -> Source &;
+};
+
+#endif // SOURCE_HPP
@@ -4,19 +4,20 @@
 #include <expr.hpp>
 #include <token.hpp>
 
-#include <memory>
+#include <span>
 #include <string>
 #include <string_view>
+#include <type_traits>
 #include <variant>
-#include <vector>
+
+struct LazyBody;
 
 struct Stmt {
 
   struct Block {
-    std::vector<std::unique_ptr<Stmt>> statements;
+    std::span<Stmt *> statements;
 
-    Block(std::vector<std::unique_ptr<Stmt>> statements)
-        : statements(std::move(statements)) {}
+    Block(std::span<Stmt *> statements) : statements(statements) {}
   };
 
   struct Break {
@@ -26,62 +27,61 @@ struct Stmt {
   };
 
   struct Expression {
-    std::unique_ptr<Expr> expression;
+    Expr *expression;
 
-    Expression(std::unique_ptr<Expr> expression)
-        : expression(std::move(expression)) {}
+    Expression(Expr *expression) : expression(expression) {}
   };
 
+  // A body that was skipped by a lazy parse is null until Parser::body
+  // parses it, the first time it is asked for.
   struct Function {
     Token name;
-    std::vector<Token> params;
-    std::unique_ptr<Stmt> body;
+    std::span<Token> params;
+    mutable Stmt *body;
+    LazyBody *lazy;
 
-    Function(Token name, std::vector<Token> params, std::unique_ptr<Stmt> body)
-        : name(std::move(name)), params(std::move(params)),
-          body(std::move(body)) {}
+    Function(Token name, std::span<Token> params, Stmt *body,
+             LazyBody *lazy = nullptr)
+        : name(std::move(name)), params(params), body(body), lazy(lazy) {}
   };
 
   struct If {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> thenBranch;
-    std::unique_ptr<Stmt> elseBranch;
-
-    If(std::unique_ptr<Expr> condition, std::unique_ptr<Stmt> thenBranch,
-       std::unique_ptr<Stmt> elseBranch)
-        : condition(std::move(condition)), thenBranch(std::move(thenBranch)),
-          elseBranch(std::move(elseBranch)) {}
+    Expr *condition;
+    Stmt *thenBranch;
+    Stmt *elseBranch;
+
+    If(Expr *condition, Stmt *thenBranch, Stmt *elseBranch)
+        : condition(condition), thenBranch(thenBranch),
+          elseBranch(elseBranch) {}
   };
 
   struct Print {
-    std::unique_ptr<Expr> expression;
+    Expr *expression;
 
-    Print(std::unique_ptr<Expr> expression)
-        : expression(std::move(expression)) {}
+    Print(Expr *expression) : expression(expression) {}
   };
 
   struct Return {
     Token keyword;
-    std::unique_ptr<Expr> value;
+    Expr *value;
 
-    Return(Token keyword, std::unique_ptr<Expr> value)
-        : keyword(std::move(keyword)), value(std::move(value)) {}
+    Return(Token keyword, Expr *value)
+        : keyword(std::move(keyword)), value(value) {}
   };
 
   struct Var {
     Token name;
-    std::unique_ptr<Expr> initializer;
+    Expr *initializer;
 
-    Var(Token name, std::unique_ptr<Expr> initializer)
-        : name(std::move(name)), initializer(std::move(initializer)) {}
+    Var(Token name, Expr *initializer)
+        : name(std::move(name)), initializer(initializer) {}
   };
 
   struct While {
-    std::unique_ptr<Expr> condition;
-    std::unique_ptr<Stmt> body;
+    Expr *condition;
+    Stmt *body;
 
-    While(std::unique_ptr<Expr> condition, std::unique_ptr<Stmt> body)
-        : condition(std::move(condition)), body(std::move(body)) {}
+    While(Expr *condition, Stmt *body) : condition(condition), body(body) {}
   };
 
   std::variant<Block, Break, Expression, Function, If, Print, Return, Var,
@@ -96,4 +96,6 @@ struct Stmt {
   }
 };
 
+static_assert(std::is_trivially_destructible_v<Stmt>);
+
 #endif // STMT_HPP
@@ -1,10 +1,15 @@
 #ifndef TOKEN_HPP
 #define TOKEN_HPP
 
-#include <string>
+#include <interner.hpp>
+#include <source.hpp>
+
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
 
 struct Token {
-  enum class Type {
+  enum class Type : uint8_t {
     // Single-character tokens
     LEFT_PAREN,
     RIGHT_PAREN,
@@ -68,18 +73,37 @@ struct Token {
     ERROR,
     END
   } type;
-  std::string lexeme;
+  // Sixteen bits of file keep a token with its symbol in sixteen bytes.
+  uint16_t file;
+  uint32_t offset;
+  uint32_t length;
+  // Identifiers and strings carry the symbol of their lexeme.
+  Symbol symbol = Interner::none;
 
-  struct {
-    std::string filename;
-    std::string source;
+  struct Location {
+    std::string_view filename;
     int row;
     int column;
-  } location;
+  };
+
+  Token() = default;
+  Token(Type type, uint32_t file, uint32_t offset, uint32_t length,
+        Symbol symbol = Interner::none)
+      : type(type), file(file), offset(offset), length(length),
+        symbol(symbol) {}
 
-  Token(Type type, std::string lexeme, std::string filename, std::string source,
-        int row, int column)
-      : type(type), lexeme(lexeme), location({filename, source, row, column}) {}
+  auto lexeme() const -> std::string_view {
+    return SourceManager::instance().get(file).text.substr(offset, length);
+  }
+
+  auto location() const -> Location {
+    const auto &source = SourceManager::instance().get(file);
+    int row = source.row(offset);
+    return {source.filename, row, int(offset - source.lines[row - 1]) + 1};
+  }
 };
 
+static_assert(sizeof(Token) == 16);
+static_assert(std::is_trivially_copyable_v<Token>);
+
 #endif // TOKEN_HPP
\ No newline at end of file
@@ -0,0 +1,266 @@
+#include <backend.hpp>
+#include <parallel.hpp>
+
+#include <format>
+#include <ranges>
+#include <system_error>
+#include <vector>
+
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/MC/MCSubtargetInfo.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Support/CodeGen.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetOptions.h>
+#if LLVM_VERSION_MAJOR >= 17
+#include <llvm/TargetParser/Host.h>
+#else
+#include <llvm/Support/Host.h>
+#endif
+
+namespace {
+
+#if LLVM_VERSION_MAJOR >= 18
+using CodeGenLevel = llvm::CodeGenOptLevel;
+constexpr auto assemblyFile = llvm::CodeGenFileType::AssemblyFile;
+constexpr auto objectFile = llvm::CodeGenFileType::ObjectFile;
+#else
+using CodeGenLevel = llvm::CodeGenOpt::Level;
+constexpr auto assemblyFile = llvm::CGFT_AssemblyFile;
+constexpr auto objectFile = llvm::CGFT_ObjectFile;
+#endif
+
+auto codegenLevel(Optimizer::Level level) -> CodeGenLevel {
+  switch (level) {
+  case Optimizer::Level::O0:
+    return CodeGenLevel::None;
+  case Optimizer::Level::O1:
+    return CodeGenLevel::Less;
+  case Optimizer::Level::O3:
+    return CodeGenLevel::Aggressive;
+  default:
+    return CodeGenLevel::Default;
+  }
+}
+
+auto hostFeatures() -> llvm::StringMap<bool> {
+#if LLVM_VERSION_MAJOR >= 19
+  return llvm::sys::getHostCPUFeatures();
+#else
+  llvm::StringMap<bool> features;
+  llvm::sys::getHostCPUFeatures(features);
+  return features;
+#endif
+}
+
+auto write(llvm::TargetMachine &machine, llvm::Module &module,
+           Backend::Output output, const std::string &path)
+    -> std::expected<void, std::string> {
+  std::error_code error;
+  auto text = output == Backend::Output::Llvm ||
+              output == Backend::Output::Assembly;
+  llvm::raw_fd_ostream out(path, error,
+                           text ? llvm::sys::fs::OF_Text
+                                : llvm::sys::fs::OF_None);
+  if (error)
+    return std::unexpected(
+        std::format("Could not open {}: {}", path, error.message()));
+
+  if (output == Backend::Output::Llvm) {
+    module.print(out, nullptr);
+  } else if (output == Backend::Output::Bitcode) {
+    llvm::WriteBitcodeToFile(module, out);
+  } else {
+    llvm::legacy::PassManager passes;
+    if (machine.addPassesToEmitFile(passes, out, nullptr,
+                                    output == Backend::Output::Assembly
+                                        ? assemblyFile
+                                        : objectFile))
+      return std::unexpected(std::format("The target cannot emit {} files",
+                                         Backend::name(output)));
+    passes.run(module);
+  }
+  out.flush();
+  if (out.has_error())
+    return std::unexpected(std::format("Could not write {}: {}", path,
+                                       out.error().message()));
+  return {};
+}
+
+// Objects are linked into an executable, or into one relocatable object.
+auto link(std::span<const llvm::SmallString<128>> objects,
+          const std::string &path, bool relocatable)
+    -> std::expected<void, std::string> {
+  auto cc = llvm::sys::findProgramByName("cc");
+  if (!cc)
+    return std::unexpected("Could not find cc to link with");
+  std::vector<llvm::StringRef> arguments = {*cc, "-o", path};
+  if (relocatable)
+    arguments.insert(arguments.end(), {"-r", "-nostdlib"});
+  for (const auto &object : objects)
+    arguments.push_back(object);
+  // The runtime needs the C library and fmod from libm.
+  if (!relocatable)
+    arguments.push_back("-lm");
+  std::string message;
+  if (llvm::sys::ExecuteAndWait(*cc, arguments, {}, {}, 0, 0, &message) != 0)
+    return std::unexpected(
+        message.empty() ? std::format("Could not link {}", path)
+                        : std::format("Could not link {}: {}", path, message));
+  return {};
+}
+
+// Modules of different contexts only meet as bitcode, so each is written out
+// and read back into the context of the first before it is linked in.
+auto merge(std::span<llvm::Module *const> modules)
+    -> std::expected<void, std::string> {
+  llvm::Linker linker(*modules[0]);
+  for (auto *module : modules.subspan(1)) {
+    llvm::SmallVector<char, 0> buffer;
+    llvm::raw_svector_ostream out(buffer);
+    llvm::WriteBitcodeToFile(*module, out);
+    auto copy = llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(buffer.data(), buffer.size()),
+                              module->getName()),
+        modules[0]->getContext());
+    if (!copy)
+      return std::unexpected(llvm::toString(copy.takeError()));
+    if (linker.linkInModule(std::move(*copy)))
+      return std::unexpected(
+          std::format("Could not link {}", module->getName().str()));
+  }
+  return {};
+}
+
+} // namespace
+
+auto Backend::create(std::string_view cpu, std::string_view features,
+                     Optimizer::Level level)
+    -> std::expected<Backend, std::string> {
+  static const bool initialized = [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    return true;
+  }();
+  (void)initialized;
+
+  auto triple = llvm::sys::getProcessTriple();
+  std::string message;
+  const auto *target = llvm::TargetRegistry::lookupTarget(triple, message);
+  if (!target)
+    return std::unexpected(message);
+
+  std::string name(cpu);
+  std::string attributes;
+  auto add = [&](llvm::StringRef feature) {
+    if (!attributes.empty())
+      attributes += ',';
+    attributes += feature;
+  };
+  if (name == "native") {
+    name = llvm::sys::getHostCPUName().str();
+    for (const auto &feature : hostFeatures())
+      add(((feature.getValue() ? "+" : "-") + feature.getKey()).str());
+  } else if (name.empty()) {
+    name = "generic";
+  }
+
+  std::unique_ptr<llvm::MCSubtargetInfo> subtarget(
+      target->createMCSubtargetInfo(triple, "", ""));
+  if (!subtarget->isCPUStringValid(name))
+    return std::unexpected(std::format("Unknown CPU {}", name));
+  for (auto part : features | std::views::split(',')) {
+    std::string_view feature(part.begin(), part.end());
+    if (feature.empty())
+      continue;
+    if (feature[0] != '+' && feature[0] != '-')
+      return std::unexpected(
+          std::format("Target features must begin with + or -: {}", feature));
+    add(llvm::StringRef(feature));
+  }
+
+  std::unique_ptr<llvm::TargetMachine> machine(target->createTargetMachine(
+      triple, name, attributes, llvm::TargetOptions(), llvm::Reloc::PIC_, {},
+      codegenLevel(level)));
+  if (!machine)
+    return std::unexpected(
+        std::format("Could not create a target machine for {}", triple));
+  return Backend{std::move(machine)};
+}
+
+auto Backend::name(Output output) -> std::string_view {
+  switch (output) {
+  case Output::Llvm:
+    return "LLVM IR";
+  case Output::Bitcode:
+    return "bitcode";
+  case Output::Assembly:
+    return "assembly";
+  case Output::Object:
+    return "object";
+  case Output::Executable:
+    return "executable";
+  }
+  return "object";
+}
+
+auto Backend::copy() const -> Backend {
+  return Backend{std::unique_ptr<llvm::TargetMachine>(
+      machine->getTarget().createTargetMachine(
+          machine->getTargetTriple().str(), machine->getTargetCPU(),
+          machine->getTargetFeatureString(), machine->Options,
+          machine->getRelocationModel(), machine->getCodeModel(),
+          machine->getOptLevel()))};
+}
+
+auto Backend::prepare(llvm::Module &module) const -> void {
+  module.setTargetTriple(machine->getTargetTriple().str());
+  module.setDataLayout(machine->createDataLayout());
+}
+
+auto Backend::emit(std::span<llvm::Module *const> modules, Output output,
+                   const std::string &path, unsigned threads) const
+    -> std::expected<void, std::string> {
+  if (output != Output::Object && output != Output::Executable) {
+    if (auto merged = merge(modules); !merged)
+      return merged;
+    return write(*machine, *modules[0], output, path);
+  }
+  if (output == Output::Object && modules.size() == 1)
+    return write(*machine, *modules[0], output, path);
+  if (output == Output::Executable && path == "-")
+    return std::unexpected("Cannot write an executable to standard output");
+
+  // The objects only live until cc has linked them.
+  std::vector<llvm::SmallString<128>> objects(modules.size());
+  auto remove = llvm::make_scope_exit([&] {
+    for (const auto &object : objects)
+      if (!object.empty())
+        llvm::sys::fs::remove(object);
+  });
+  for (auto &object : objects)
+    if (auto error = llvm::sys::fs::createTemporaryFile("bds", "o", object))
+      return std::unexpected(std::format(
+          "Could not create a temporary file: {}", error.message()));
+
+  std::vector<std::expected<void, std::string>> written(modules.size());
+  parallel(modules.size(), threads, [&](size_t i) {
+    auto local = copy();
+    written[i] = write(*local.machine, *modules[i], Output::Object,
+                       std::string(objects[i].str()));
+  });
+  for (auto &result : written)
+    if (!result)
+      return result;
+  return link(objects, path, output == Output::Object);
+}
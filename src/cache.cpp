@@ -0,0 +1,276 @@
+#include <cache.hpp>
+#include <interner.hpp>
+#include <source.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+#include <llvm/Support/xxhash.h>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CACHE_MMAP 1
+#endif
+
+#ifndef BDS_VERSION
+#define BDS_VERSION "unknown"
+#endif
+
+namespace {
+
+constexpr char magic[4] = {'B', 'D', 'S', 'C'};
+// Bump format whenever the header, Token or the FlatAST tables change. The
+// assertions below fail when they do, as a reminder.
+constexpr uint32_t format = 2;
+
+static_assert(sizeof(Token) == 16);
+static_assert(std::to_underlying(FlatAST::Kind::While) == 19);
+
+struct Header {
+  char magic[4];
+  uint32_t format;
+  uint64_t sourceSize;
+  uint64_t maxNesting;
+  uint64_t checksum;
+  uint32_t nodes;
+  uint32_t extra;
+  uint32_t tokens;
+  uint32_t roots;
+  uint32_t symbols;
+  uint32_t reserved;
+};
+
+static_assert(std::is_trivially_copyable_v<Header>);
+static_assert(sizeof(Header) % 8 == 0);
+
+// Each table is padded to eight bytes so that every table in a mapped entry
+// is aligned. The checksum is the hash of the hashes of the tables, so that
+// they can be written straight from the FlatAST.
+struct Writer {
+  FILE *stream;
+  std::vector<uint64_t> hashes;
+  bool written = true;
+
+  template <class T> auto write(const std::vector<T> &table) -> void {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const char zeros[8] = {};
+    size_t size = table.size() * sizeof(T);
+    hashes.push_back(llvm::xxHash64(
+        llvm::StringRef(reinterpret_cast<const char *>(table.data()), size)));
+    written &= std::fwrite(table.data(), 1, size, stream) == size;
+    written &= std::fwrite(zeros, 1, -size & 7, stream) == (-size & 7);
+  }
+};
+
+struct Reader {
+  std::string_view in;
+  std::vector<uint64_t> hashes;
+
+  template <class T>
+  auto read(std::vector<T> &table, size_t count) -> bool {
+    size_t size = count * sizeof(T);
+    if (in.size() < size + (-size & 7))
+      return false;
+
+    table.resize(count);
+    std::memcpy(table.data(), in.data(), size);
+    hashes.push_back(llvm::xxHash64(llvm::StringRef(in.data(), size)));
+    in.remove_prefix(size + (-size & 7));
+    return true;
+  }
+};
+
+auto checksum(const std::vector<uint64_t> &hashes) -> uint64_t {
+  return llvm::xxHash64(
+      llvm::StringRef(reinterpret_cast<const char *>(hashes.data()),
+                      hashes.size() * sizeof(uint64_t)));
+}
+
+auto parse(std::string_view in, uint32_t file, size_t sourceSize,
+           size_t maxNesting) -> std::optional<FlatAST> {
+  Header header;
+  if (in.size() < sizeof header)
+    return std::nullopt;
+  std::memcpy(&header, in.data(), sizeof header);
+
+  if (std::memcmp(header.magic, magic, sizeof magic) != 0 ||
+      header.format != format || header.sourceSize != sourceSize ||
+      header.maxNesting != maxNesting)
+    return std::nullopt;
+
+  FlatAST ast;
+  std::vector<uint32_t> spellings;
+  Reader reader{in.substr(sizeof header)};
+  if (!reader.read(ast.kinds, header.nodes) ||
+      !reader.read(ast.tokenIndices, header.nodes) ||
+      !reader.read(ast.lhs, header.nodes) ||
+      !reader.read(ast.rhs, header.nodes) ||
+      !reader.read(ast.extra, header.extra) ||
+      !reader.read(ast.tokens, header.tokens) ||
+      !reader.read(ast.roots, header.roots) ||
+      !reader.read(spellings, header.symbols) || !reader.in.empty() ||
+      checksum(reader.hashes) != header.checksum)
+    return std::nullopt;
+
+  // The entry may have been written for the same text under another name,
+  // and by another run with other symbols.
+  auto text = SourceManager::instance().get(file).text;
+  std::vector<Symbol> symbols;
+  symbols.reserve(spellings.size());
+  for (auto index : spellings) {
+    if (index >= ast.tokens.size())
+      return std::nullopt;
+    const auto &token = ast.tokens[index];
+    symbols.push_back(
+        Interner::instance().intern(text.substr(token.offset, token.length)));
+  }
+
+  for (auto &token : ast.tokens) {
+    token.file = file;
+    if (token.symbol == Interner::none)
+      continue;
+    if (token.symbol >= symbols.size())
+      return std::nullopt;
+    token.symbol = symbols[token.symbol];
+  }
+  return ast;
+}
+
+// Names the build of bds that is running, so that an entry is only ever read
+// by the build that wrote it. The version stays the same between releases,
+// and the grammar can change without changing format. The size and
+// modification time of the executable change with every build. Where the
+// executable cannot be found, only the version is used.
+auto build() -> const std::string & {
+  static const std::string name = [] {
+    std::error_code error;
+    auto self = std::filesystem::read_symlink("/proc/self/exe", error);
+    auto size = error ? 0 : std::filesystem::file_size(self, error);
+    auto time = error ? std::filesystem::file_time_type()
+                      : std::filesystem::last_write_time(self, error);
+    if (error)
+      return std::string(BDS_VERSION);
+    auto identity =
+        std::format("{}:{}", size, time.time_since_epoch().count());
+    return std::format("{}-{:08x}", BDS_VERSION,
+                       uint32_t(llvm::xxHash64(identity)));
+  }();
+  return name;
+}
+
+} // namespace
+
+Cache::Cache(const std::filesystem::path &directory, uint32_t file,
+             size_t maxNesting)
+    : file(file), maxNesting(maxNesting) {
+  auto text = SourceManager::instance().get(file).text;
+  auto hash = llvm::xxHash64(llvm::StringRef(text.data(), text.size()));
+  path = directory / std::format("{:016x}-{}.bdsc", hash, build());
+}
+
+auto Cache::load() const -> std::optional<FlatAST> {
+  auto sourceSize = SourceManager::instance().get(file).text.size();
+
+#ifdef CACHE_MMAP
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return std::nullopt;
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+      return std::nullopt;
+
+    auto ast = parse({static_cast<const char *>(mapping), size_t(info.st_size)},
+                     file, sourceSize, maxNesting);
+    munmap(mapping, info.st_size);
+    return ast;
+  }
+  close(fd);
+  return std::nullopt;
+#else
+  std::ifstream in(path, std::ios::binary);
+  std::string buffer{std::istreambuf_iterator<char>(in), {}};
+  return parse(buffer, file, sourceSize, maxNesting);
+#endif
+}
+
+// Written under a temporary name and renamed into place, so that a reader
+// never sees a partial entry and concurrent writers of the same entry do not
+// interleave.
+auto Cache::store(const FlatAST &ast) const -> bool {
+  Header header{};
+  std::memcpy(header.magic, magic, sizeof magic);
+  header.format = format;
+  header.sourceSize = SourceManager::instance().get(file).text.size();
+  header.maxNesting = maxNesting;
+  header.nodes = ast.kinds.size();
+  header.extra = ast.extra.size();
+  header.tokens = ast.tokens.size();
+  header.roots = ast.roots.size();
+
+  // Symbols mean nothing to another run, so the entry numbers the ones it
+  // uses from zero and records a token spelling each of them.
+  std::vector<Token> tokens = ast.tokens;
+  std::unordered_map<Symbol, uint32_t> local;
+  std::vector<uint32_t> spellings;
+  for (uint32_t i = 0; i < tokens.size(); i++) {
+    if (tokens[i].symbol == Interner::none)
+      continue;
+    auto [it, inserted] = local.try_emplace(tokens[i].symbol, spellings.size());
+    if (inserted)
+      spellings.push_back(i);
+    tokens[i].symbol = it->second;
+  }
+  header.symbols = spellings.size();
+
+  std::error_code error;
+  std::filesystem::create_directories(path.parent_path(), error);
+  auto temporary = path;
+  temporary += std::format(".{:08x}.tmp", std::random_device()());
+
+  FILE *stream = std::fopen(temporary.c_str(), "wb");
+  if (!stream)
+    return false;
+
+  // The header goes first with a zero checksum, and is rewritten once the
+  // tables are out.
+  Writer writer{stream};
+  writer.written = std::fwrite(&header, sizeof header, 1, stream) == 1;
+  writer.write(ast.kinds);
+  writer.write(ast.tokenIndices);
+  writer.write(ast.lhs);
+  writer.write(ast.rhs);
+  writer.write(ast.extra);
+  writer.write(tokens);
+  writer.write(ast.roots);
+  writer.write(spellings);
+  header.checksum = checksum(writer.hashes);
+  writer.written &= std::fseek(stream, 0, SEEK_SET) == 0 &&
+                    std::fwrite(&header, sizeof header, 1, stream) == 1;
+  bool written = std::fclose(stream) == 0 && writer.written;
+
+  if (written)
+    std::filesystem::rename(temporary, path, error);
+  if (!written || error) {
+    std::filesystem::remove(temporary, error);
+    return false;
+  }
+  return true;
+}
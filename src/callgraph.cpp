@@ -0,0 +1,112 @@
+#include <callgraph.hpp>
+#include <interner.hpp>
+#include <parser.hpp>
+
+#include <initializer_list>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+
+namespace {
+
+// Collects the names used in a tree without recursion.
+struct Walker {
+  using Node = std::variant<const Expr *, const Stmt *>;
+
+  std::vector<Node> nodes;
+  std::vector<Symbol> names;
+
+  auto walk(Node root) -> void {
+    nodes.push_back(root);
+    while (!nodes.empty()) {
+      auto node = nodes.back();
+      nodes.pop_back();
+      std::visit(
+          [this](const auto *n) {
+            if (n)
+              n->accept([this](const auto &child) { visit(child); });
+          },
+          node);
+    }
+  }
+
+  auto push(std::initializer_list<Node> list) -> void {
+    nodes.insert(nodes.end(), list);
+  }
+
+  template <class T> auto push(std::span<T *> list) -> void {
+    nodes.insert(nodes.end(), list.begin(), list.end());
+  }
+
+  auto visit(const Expr::Assign &expr) -> void { push({expr.value}); }
+  auto visit(const Expr::Binary &expr) -> void {
+    push({expr.left, expr.right});
+  }
+  auto visit(const Expr::Call &expr) -> void {
+    push({expr.callee});
+    push(expr.arguments);
+  }
+  auto visit(const Expr::Get &expr) -> void { push({expr.object}); }
+  auto visit(const Expr::Grouping &expr) -> void { push({expr.expression}); }
+  auto visit(const Expr::Literal &) -> void {}
+  auto visit(const Expr::Logical &expr) -> void {
+    push({expr.left, expr.right});
+  }
+  auto visit(const Expr::Set &expr) -> void { push({expr.object, expr.value}); }
+  auto visit(const Expr::This &) -> void {}
+  auto visit(const Expr::Unary &expr) -> void { push({expr.right}); }
+  auto visit(const Expr::Variable &expr) -> void {
+    names.push_back(expr.name.symbol);
+  }
+
+  auto visit(const Stmt::Block &stmt) -> void { push(stmt.statements); }
+  auto visit(const Stmt::Break &) -> void {}
+  auto visit(const Stmt::Expression &stmt) -> void {
+    push({stmt.expression});
+  }
+  auto visit(const Stmt::Function &stmt) -> void {
+    push({Parser::body(stmt)});
+  }
+  auto visit(const Stmt::If &stmt) -> void {
+    push({stmt.condition, stmt.thenBranch, stmt.elseBranch});
+  }
+  auto visit(const Stmt::Print &stmt) -> void { push({stmt.expression}); }
+  auto visit(const Stmt::Return &stmt) -> void { push({stmt.value}); }
+  auto visit(const Stmt::Var &stmt) -> void { push({stmt.initializer}); }
+  auto visit(const Stmt::While &stmt) -> void {
+    push({stmt.condition, stmt.body});
+  }
+};
+
+} // namespace
+
+auto reachable(std::span<Stmt *const> statements, std::string_view entry)
+    -> std::vector<const Stmt::Function *> {
+  // A later declaration of the same name replaces the earlier one.
+  std::unordered_map<Symbol, const Stmt::Function *> functions;
+  for (const auto *stmt : statements) {
+    if (!stmt)
+      continue;
+    if (auto *function = std::get_if<Stmt::Function>(&stmt->stmt))
+      functions[function->name.symbol] = function;
+  }
+
+  Walker walker;
+  walker.names.push_back(Interner::instance().find(entry));
+  for (const auto *stmt : statements)
+    if (stmt && !std::holds_alternative<Stmt::Function>(stmt->stmt))
+      walker.walk(stmt);
+
+  std::vector<const Stmt::Function *> order;
+  std::unordered_set<const Stmt::Function *> seen;
+  for (size_t name = 0, walked = 0;; walked++) {
+    for (; name < walker.names.size(); name++)
+      if (auto it = functions.find(walker.names[name]);
+          it != functions.end() && seen.insert(it->second).second)
+        order.push_back(it->second);
+
+    if (walked == order.size())
+      return order;
+    walker.walk(Parser::body(*order[walked]));
+  }
+}
@@ -1,97 +1,776 @@
 #include <codegen.hpp>
+#include <parallel.hpp>
+#include <parser.hpp>
 
-#include <iostream>
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <format>
 
-auto Compiler::compile(std::vector<std::unique_ptr<Stmt>> statements) -> void {
-  for (const auto &stmt : statements) {
-    stmt->accept([this](const auto &s) { codegen(s); });
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/Support/CrashRecoveryContext.h>
+
+namespace {
+
+// The token a node begins with, to report a failure in its subtree at.
+auto firstToken(const Expr *expr) -> const Token * {
+  while (true) {
+    if (const auto *assign = std::get_if<Expr::Assign>(&expr->expr))
+      return &assign->name;
+    else if (const auto *binary = std::get_if<Expr::Binary>(&expr->expr))
+      expr = binary->left;
+    else if (const auto *call = std::get_if<Expr::Call>(&expr->expr))
+      expr = call->callee;
+    else if (const auto *get = std::get_if<Expr::Get>(&expr->expr))
+      expr = get->object;
+    else if (const auto *group = std::get_if<Expr::Grouping>(&expr->expr))
+      expr = group->expression;
+    else if (const auto *logical = std::get_if<Expr::Logical>(&expr->expr))
+      expr = logical->left;
+    else if (const auto *set = std::get_if<Expr::Set>(&expr->expr))
+      expr = set->object;
+    else if (const auto *literal = std::get_if<Expr::Literal>(&expr->expr))
+      return &literal->value;
+    else if (const auto *self = std::get_if<Expr::This>(&expr->expr))
+      return &self->keyword;
+    else if (const auto *unary = std::get_if<Expr::Unary>(&expr->expr))
+      return &unary->op;
+    else
+      return &std::get<Expr::Variable>(expr->expr).name;
+  }
+}
+
+// Only an empty block has no token.
+auto firstToken(const Stmt *stmt) -> const Token * {
+  while (const auto *block = std::get_if<Stmt::Block>(&stmt->stmt)) {
+    if (block->statements.empty())
+      return nullptr;
+    stmt = block->statements.front();
+  }
+  return stmt->accept([](const auto &node) -> const Token * {
+    using T = std::decay_t<decltype(node)>;
+    if constexpr (std::is_same_v<T, Stmt::Break> ||
+                  std::is_same_v<T, Stmt::Return>)
+      return &node.keyword;
+    else if constexpr (std::is_same_v<T, Stmt::Function> ||
+                       std::is_same_v<T, Stmt::Var>)
+      return &node.name;
+    else if constexpr (std::is_same_v<T, Stmt::If> ||
+                       std::is_same_v<T, Stmt::While>)
+      return firstToken(node.condition);
+    else if constexpr (std::is_same_v<T, Stmt::Block>)
+      return nullptr;
+    else
+      return firstToken(node.expression);
+  });
+}
+
+} // namespace
+
+Program::Program(std::span<Stmt *const> statements,
+                 Diagnostics &diagnostics)
+    : statements(statements), resolution(resolve(statements, diagnostics)) {
+  globals.resize(resolution.globals);
+  for (const auto *stmt : statements) {
+    if (!stmt)
+      continue;
+    auto declaration = resolution.declarations.find(stmt);
+    if (declaration == resolution.declarations.end())
+      continue;
+    auto &global = globals[declaration->second.index];
+    if (const auto *function = std::get_if<Stmt::Function>(&stmt->stmt)) {
+      global.function = stmt;
+      functions.push_back(stmt);
+      if (function->name.lexeme() == "main")
+        entry = stmt;
+    } else if (std::holds_alternative<Stmt::Var>(stmt->stmt) &&
+               !global.variable) {
+      global.variable = stmt;
+    }
+  }
+}
+
+auto Program::shards() const -> size_t {
+  return std::max<size_t>(1, (functions.size() + shardSize - 1) / shardSize);
+}
+
+auto Program::compile(Diagnostics &diagnostics, std::string_view name,
+                      unsigned threads, bool names) const
+    -> std::vector<std::unique_ptr<Compiler>> {
+  std::vector<std::unique_ptr<Compiler>> compilers(shards());
+  std::vector<Diagnostics> reports(compilers.size(),
+                                   Diagnostics(diagnostics.limit()));
+  parallel(compilers.size(), threads, [&](size_t shard) {
+    compilers[shard] =
+        std::make_unique<Compiler>(reports[shard], *this, shard, name);
+    compilers[shard]->context->setDiscardValueNames(!names);
+    compilers[shard]->compile();
+  });
+  for (auto &report : reports)
+    diagnostics.merge(std::move(report));
+  return compilers;
+}
+
+Compiler::Compiler(Diagnostics &diagnostics, const Program &program,
+                   size_t shard, std::string_view name)
+    : context(std::make_unique<llvm::LLVMContext>()),
+      module(std::make_unique<llvm::Module>(
+          llvm::StringRef(name.data(), name.size()), *context)),
+      builder(*context), diagnostics(diagnostics), program(program),
+      resolution(program.resolution), shard(shard) {}
+
+auto Compiler::compile() -> void {
+  char bottom;
+  stackBase = reinterpret_cast<std::uintptr_t>(&bottom);
+  declareRuntime();
+  globals.resize(resolution.globals);
+
+  auto first = std::min(shard * Program::shardSize, program.functions.size());
+  auto count =
+      std::min(Program::shardSize, program.functions.size() - first);
+  for (const auto *stmt :
+       std::span(program.functions).subspan(first, count))
+    codegen(*stmt);
+  if (shard != 0)
+    return;
+
+  // Top-level functions are defined on their own above, so that they can
+  // be called before their declaration, and main runs everything else.
+  auto *main = llvm::Function::Create(
+      llvm::FunctionType::get(builder.getInt32Ty(), false),
+      llvm::Function::ExternalLinkage, "main", *module);
+  builder.SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", main));
+  for (const auto *stmt : program.statements) {
+    if (stmt && !std::holds_alternative<Stmt::Function>(stmt->stmt))
+      codegen(*stmt);
   }
+
+  if (const auto *entry = program.entry) {
+    const auto &function = std::get<Stmt::Function>(entry->stmt);
+    if (function.params.empty())
+      builder.CreateCall(
+          global(resolution.declarations.at(entry).index).function);
+    else
+      report(Error::ArityMismatch, function.name, "expected 0");
+  }
+  builder.CreateRet(builder.getInt32(0));
 }
 
 auto Compiler::codegen(const Expr &expr) -> llvm::Value * {
-  return expr.accept([this](const auto &e) { return codegen(e); });
+  return withStack(&expr, [&] {
+    currentExpr = &expr;
+    return expr.accept([this](const auto &e) { return codegen(e); });
+  });
 }
 
 auto Compiler::codegen(const Stmt &stmt) -> llvm::Value * {
-  return stmt.accept([this](const auto &s) { return codegen(s); });
+  return withStack(&stmt, [&] {
+    currentStmt = &stmt;
+    return stmt.accept([this](const auto &s) { return codegen(s); });
+  });
 }
 
 auto Compiler::codegen(const Expr::Assign &expr) -> llvm::Value * {
-  return nullptr;
+  auto *storage = variable(currentExpr, expr.name);
+  auto *value = codegen(*expr.value);
+  if (storage)
+    builder.CreateStore(value, storage);
+  return value;
 }
 
 auto Compiler::codegen(const Expr::Binary &expr) -> llvm::Value * {
-  return nullptr;
+  auto *left = codegen(*expr.left);
+  auto *right = codegen(*expr.right);
+  auto *numbers = builder.CreateAnd(isNumber(left), isNumber(right));
+
+  // Numbers are equal by value and everything else by identity. Equal string
+  // literals share their storage, in every shard.
+  if (expr.op.type == Token::Type::EQUAL_EQUAL ||
+      expr.op.type == Token::Type::BANG_EQUAL) {
+    auto *equal = builder.CreateSelect(
+        numbers, builder.CreateFCmpOEQ(toNumber(left), toNumber(right)),
+        builder.CreateICmpEQ(left, right));
+    if (expr.op.type == Token::Type::BANG_EQUAL)
+      equal = builder.CreateNot(equal);
+    return boolean(equal);
+  }
+
+  check(numbers, "Operands must be numbers", expr.op);
+  auto *a = toNumber(left);
+  auto *b = toNumber(right);
+  switch (expr.op.type) {
+  case Token::Type::PLUS:
+    return fromNumber(builder.CreateFAdd(a, b));
+  case Token::Type::MINUS:
+    return fromNumber(builder.CreateFSub(a, b));
+  case Token::Type::STAR:
+    return fromNumber(builder.CreateFMul(a, b));
+  case Token::Type::SLASH:
+    return fromNumber(builder.CreateFDiv(a, b));
+  case Token::Type::MODULO:
+    return fromNumber(builder.CreateFRem(a, b));
+  case Token::Type::GREATER:
+    return boolean(builder.CreateFCmpOGT(a, b));
+  case Token::Type::GREATER_EQUAL:
+    return boolean(builder.CreateFCmpOGE(a, b));
+  case Token::Type::LESS:
+    return boolean(builder.CreateFCmpOLT(a, b));
+  case Token::Type::LESS_EQUAL:
+    return boolean(builder.CreateFCmpOLE(a, b));
+  default:
+    return report(Error::Unsupported, expr.op, "operator");
+  }
 }
 
+// Only functions named directly can be called, so every call is direct and
+// its arity is checked here.
 auto Compiler::codegen(const Expr::Call &expr) -> llvm::Value * {
-  return nullptr;
+  const auto *callee = std::get_if<Expr::Variable>(&expr.callee->expr);
+  if (!callee)
+    return report(Error::NotCallable, expr.paren);
+
+  auto *target = slot(resolution.uses.at(expr.callee), callee->name);
+  if (!target)
+    return constant(nil);
+  if (!target->function)
+    return report(Error::NotCallable, callee->name);
+
+  auto *function = target->function;
+  if (function->arg_size() != expr.arguments.size())
+    return report(Error::ArityMismatch, expr.paren,
+                  std::format("expected {}", function->arg_size()));
+
+  std::vector<llvm::Value *> arguments;
+  arguments.reserve(expr.arguments.size());
+  for (const auto *argument : expr.arguments)
+    arguments.push_back(codegen(*argument));
+  return builder.CreateCall(function, arguments);
 }
 
 auto Compiler::codegen(const Expr::Get &expr) -> llvm::Value * {
-  return nullptr;
+  return report(Error::Unsupported, expr.name, "properties");
 }
 
 auto Compiler::codegen(const Expr::Grouping &expr) -> llvm::Value * {
-  return nullptr;
+  return codegen(*expr.expression);
 }
 
 auto Compiler::codegen(const Expr::Literal &expr) -> llvm::Value * {
-  return nullptr;
+  switch (expr.value.type) {
+  case Token::Type::NUMBER: {
+    auto text = expr.value.lexeme();
+    double value = 0;
+    std::from_chars(text.data(), text.data() + text.size(), value);
+    return constant(std::bit_cast<uint64_t>(value));
+  }
+  case Token::Type::STRING:
+    return string(expr.value);
+  case Token::Type::TRUE:
+    return constant(trueValue);
+  case Token::Type::FALSE:
+    return constant(falseValue);
+  default:
+    return constant(nil);
+  }
 }
 
+// Yields whichever operand decided the result, like the and and or of the
+// languages bds borrows them from.
 auto Compiler::codegen(const Expr::Logical &expr) -> llvm::Value * {
-  return nullptr;
+  auto *left = codegen(*expr.left);
+  auto *function = builder.GetInsertBlock()->getParent();
+  auto *from = builder.GetInsertBlock();
+  auto *rest = llvm::BasicBlock::Create(*context, "logical.rhs", function);
+  auto *end = llvm::BasicBlock::Create(*context, "logical.end", function);
+  if (expr.op.type == Token::Type::AND)
+    builder.CreateCondBr(truthy(left), rest, end);
+  else
+    builder.CreateCondBr(truthy(left), end, rest);
+
+  builder.SetInsertPoint(rest);
+  auto *right = codegen(*expr.right);
+  builder.CreateBr(end);
+  auto *to = builder.GetInsertBlock();
+
+  builder.SetInsertPoint(end);
+  auto *phi = builder.CreatePHI(builder.getInt64Ty(), 2);
+  phi->addIncoming(left, from);
+  phi->addIncoming(right, to);
+  return phi;
 }
 
 auto Compiler::codegen(const Expr::Set &expr) -> llvm::Value * {
-  return nullptr;
+  return report(Error::Unsupported, expr.name, "properties");
 }
 
 auto Compiler::codegen(const Expr::This &expr) -> llvm::Value * {
-  return nullptr;
+  return report(Error::Unsupported, expr.keyword, "self");
 }
 
 auto Compiler::codegen(const Expr::Unary &expr) -> llvm::Value * {
-  return nullptr;
+  auto *right = codegen(*expr.right);
+  if (expr.op.type == Token::Type::BANG)
+    return boolean(builder.CreateNot(truthy(right)));
+
+  check(isNumber(right), "Operand must be a number", expr.op);
+  return fromNumber(builder.CreateFNeg(toNumber(right)));
 }
 
 auto Compiler::codegen(const Expr::Variable &expr) -> llvm::Value * {
-  return nullptr;
+  auto *storage = variable(currentExpr, expr.name);
+  if (!storage)
+    return constant(nil);
+  auto name = expr.name.lexeme();
+  return builder.CreateLoad(builder.getInt64Ty(), storage,
+                            llvm::StringRef(name.data(), name.size()));
 }
 
 auto Compiler::codegen(const Stmt::Block &stmt) -> llvm::Value * {
+  open(currentStmt, false);
+  for (const auto *child : stmt.statements) {
+    if (child)
+      codegen(*child);
+  }
+  close();
   return nullptr;
 }
 
 auto Compiler::codegen(const Stmt::Break &stmt) -> llvm::Value * {
+  if (loops.empty())
+    return report(Error::BreakOutsideLoop, stmt.keyword);
+  builder.CreateBr(loops.back());
+  unreachable();
   return nullptr;
 }
 
 auto Compiler::codegen(const Stmt::Expression &stmt) -> llvm::Value * {
+  codegen(*stmt.expression);
   return nullptr;
 }
 
 auto Compiler::codegen(const Stmt::Function &stmt) -> llvm::Value * {
-  return nullptr;
+  const auto *owner = currentStmt;
+  auto binding = resolution.declarations.at(owner);
+  llvm::Function *function = nullptr;
+  if (binding.kind == Binding::Kind::Global) {
+    function = global(binding.index).function;
+  } else {
+    function = declare(stmt, llvm::Function::InternalLinkage);
+    slots[scopes.back().base + binding.index].function = function;
+  }
+  define(owner, stmt, function);
+  return function;
 }
 
 auto Compiler::codegen(const Stmt::If &stmt) -> llvm::Value * {
+  auto *condition = truthy(codegen(*stmt.condition));
+  auto *function = builder.GetInsertBlock()->getParent();
+  auto *then = llvm::BasicBlock::Create(*context, "if.then", function);
+  auto *otherwise =
+      stmt.elseBranch ? llvm::BasicBlock::Create(*context, "if.else", function)
+                      : nullptr;
+  auto *end = llvm::BasicBlock::Create(*context, "if.end", function);
+  builder.CreateCondBr(condition, then, otherwise ? otherwise : end);
+
+  builder.SetInsertPoint(then);
+  if (stmt.thenBranch)
+    codegen(*stmt.thenBranch);
+  builder.CreateBr(end);
+
+  if (otherwise) {
+    builder.SetInsertPoint(otherwise);
+    codegen(*stmt.elseBranch);
+    builder.CreateBr(end);
+  }
+
+  builder.SetInsertPoint(end);
   return nullptr;
 }
 
 auto Compiler::codegen(const Stmt::Print &stmt) -> llvm::Value * {
+  builder.CreateCall(printFunction, {codegen(*stmt.expression)});
   return nullptr;
 }
 
 auto Compiler::codegen(const Stmt::Return &stmt) -> llvm::Value * {
+  if (std::ranges::none_of(scopes, &Scope::function))
+    return report(Error::ReturnOutsideFunction, stmt.keyword);
+  builder.CreateRet(stmt.value ? codegen(*stmt.value) : constant(nil));
+  unreachable();
   return nullptr;
 }
 
 auto Compiler::codegen(const Stmt::Var &stmt) -> llvm::Value * {
+  auto binding = resolution.declarations.at(currentStmt);
+  auto *value = stmt.initializer ? codegen(*stmt.initializer) : constant(nil);
+  if (binding.kind == Binding::Kind::Global) {
+    builder.CreateStore(value, global(binding.index).variable);
+  } else {
+    auto &target = slots[scopes.back().base + binding.index];
+    target.variable = allocate(stmt.name);
+    builder.CreateStore(value, target.variable);
+  }
   return nullptr;
 }
 
 auto Compiler::codegen(const Stmt::While &stmt) -> llvm::Value * {
+  auto *function = builder.GetInsertBlock()->getParent();
+  auto *condition = llvm::BasicBlock::Create(*context, "while.cond", function);
+  auto *body = llvm::BasicBlock::Create(*context, "while.body", function);
+  auto *end = llvm::BasicBlock::Create(*context, "while.end", function);
+  builder.CreateBr(condition);
+
+  builder.SetInsertPoint(condition);
+  builder.CreateCondBr(truthy(codegen(*stmt.condition)), body, end);
+
+  builder.SetInsertPoint(body);
+  loops.push_back(end);
+  if (stmt.body)
+    codegen(*stmt.body);
+  loops.pop_back();
+  builder.CreateBr(condition);
+
+  builder.SetInsertPoint(end);
   return nullptr;
 }
+
+auto Compiler::withStack(std::variant<const Expr *, const Stmt *> node,
+                         llvm::function_ref<llvm::Value *()> lower)
+    -> llvm::Value * {
+  char top;
+  if (stackBase - reinterpret_cast<std::uintptr_t>(&top) < stackBudget)
+    return lower();
+
+  auto base = stackBase;
+  llvm::Value *result = nullptr;
+  bool done = llvm::CrashRecoveryContext().RunSafelyOnThread(
+      [&] {
+        char bottom;
+        stackBase = reinterpret_cast<std::uintptr_t>(&bottom);
+        result = lower();
+      },
+      threadStack);
+  stackBase = base;
+  if (done)
+    return result;
+  if (const auto *token =
+          std::visit([](auto *node) { return firstToken(node); }, node))
+    report(Error::NestingTooDeep, *token, "(lowering failed)");
+  return constant(nil);
+}
+
+auto Compiler::declare(const Stmt::Function &stmt,
+                       llvm::GlobalValue::LinkageTypes linkage)
+    -> llvm::Function * {
+  std::vector<llvm::Type *> params(stmt.params.size(), builder.getInt64Ty());
+  auto name = stmt.name.lexeme();
+  auto *function = llvm::Function::Create(
+      llvm::FunctionType::get(builder.getInt64Ty(), params, false), linkage,
+      "bds." + llvm::StringRef(name.data(), name.size()), *module);
+  for (size_t i = 0; auto &arg : function->args()) {
+    auto param = stmt.params[i++].lexeme();
+    arg.setName(llvm::StringRef(param.data(), param.size()));
+  }
+  return function;
+}
+
+// The parameters and the top level of the body share the function's scope,
+// as they do in the resolver.
+auto Compiler::define(const Stmt *owner, const Stmt::Function &stmt,
+                      llvm::Function *function) -> void {
+  auto point = builder.saveIP();
+  auto enclosing = std::exchange(loops, {});
+  auto enclosingFailure = std::exchange(failure, {});
+  builder.SetInsertPoint(llvm::BasicBlock::Create(*context, "entry", function));
+
+  open(owner, true);
+  for (size_t i = 0; auto &arg : function->args()) {
+    auto &target = slots[scopes.back().base + i];
+    target.variable = allocate(stmt.params[i++]);
+    builder.CreateStore(&arg, target.variable);
+  }
+  if (const auto *body = Parser::body(stmt)) {
+    if (const auto *block = std::get_if<Stmt::Block>(&body->stmt)) {
+      for (const auto *child : block->statements) {
+        if (child)
+          codegen(*child);
+      }
+    } else {
+      codegen(*body);
+    }
+  }
+  builder.CreateRet(constant(nil));
+  close();
+
+  loops = std::move(enclosing);
+  failure = enclosingFailure;
+  builder.restoreIP(point);
+}
+
+// bds.print writes a value and a newline to standard output, and bds.fail
+// reports a runtime error and exits.
+auto Compiler::declareRuntime() -> void {
+  auto *i32 = builder.getInt32Ty();
+  auto *i64 = builder.getInt64Ty();
+  auto *pointer = builder.getInt8PtrTy();
+  auto printf = module->getOrInsertFunction(
+      "printf", llvm::FunctionType::get(i32, {pointer}, true));
+  auto puts = module->getOrInsertFunction(
+      "puts", llvm::FunctionType::get(i32, {pointer}, false));
+  auto fflush = module->getOrInsertFunction(
+      "fflush", llvm::FunctionType::get(i32, {pointer}, false));
+  auto dprintf = module->getOrInsertFunction(
+      "dprintf", llvm::FunctionType::get(i32, {i32, pointer}, true));
+  auto exit = module->getOrInsertFunction(
+      "exit", llvm::FunctionType::get(builder.getVoidTy(), {i32}, false));
+
+  printFunction = llvm::Function::Create(
+      llvm::FunctionType::get(builder.getVoidTy(), {i64}, false),
+      llvm::Function::InternalLinkage, "bds.print", *module);
+  auto *value = printFunction->getArg(0);
+  value->setName("value");
+  auto *entry = llvm::BasicBlock::Create(*context, "entry", printFunction);
+  auto *number = llvm::BasicBlock::Create(*context, "number", printFunction);
+  auto *other = llvm::BasicBlock::Create(*context, "other", printFunction);
+  auto *text = llvm::BasicBlock::Create(*context, "string", printFunction);
+  auto *word = llvm::BasicBlock::Create(*context, "word", printFunction);
+
+  builder.SetInsertPoint(entry);
+  builder.CreateCondBr(isNumber(value), number, other);
+
+  builder.SetInsertPoint(number);
+  builder.CreateCall(printf, {builder.CreateGlobalStringPtr("%.15g\n", ".fmt",
+                                                           0, module.get()),
+                              toNumber(value)});
+  builder.CreateRetVoid();
+
+  builder.SetInsertPoint(other);
+  auto *tag = builder.CreateAnd(value, constant(stringTag));
+  builder.CreateCondBr(builder.CreateICmpEQ(tag, constant(stringTag)), text,
+                       word);
+
+  builder.SetInsertPoint(text);
+  auto *address = builder.CreateAnd(value, constant(~stringTag));
+  builder.CreateCall(puts, {builder.CreateIntToPtr(address, pointer)});
+  builder.CreateRetVoid();
+
+  builder.SetInsertPoint(word);
+  auto *name = builder.CreateSelect(
+      builder.CreateICmpEQ(value, constant(nil)),
+      builder.CreateGlobalStringPtr("nil", ".nil", 0, module.get()),
+      builder.CreateSelect(
+          builder.CreateICmpEQ(value, constant(trueValue)),
+          builder.CreateGlobalStringPtr("true", ".true", 0, module.get()),
+          builder.CreateGlobalStringPtr("false", ".false", 0, module.get())));
+  builder.CreateCall(puts, {name});
+  builder.CreateRetVoid();
+
+  failFunction = llvm::Function::Create(
+      llvm::FunctionType::get(builder.getVoidTy(), {pointer, pointer, i32, i32},
+                              false),
+      llvm::Function::InternalLinkage, "bds.fail", *module);
+  failFunction->addFnAttr(llvm::Attribute::NoReturn);
+  failFunction->addFnAttr(llvm::Attribute::Cold);
+  for (size_t i = 0; auto name : {"message", "file", "row", "column"})
+    failFunction->getArg(i++)->setName(name);
+  builder.SetInsertPoint(
+      llvm::BasicBlock::Create(*context, "entry", failFunction));
+  builder.CreateCall(fflush, {llvm::ConstantPointerNull::get(pointer)});
+  builder.CreateCall(
+      dprintf,
+      {builder.getInt32(2),
+       builder.CreateGlobalStringPtr("Runtime error: %s at %s:%d:%d!\n",
+                                     ".error", 0, module.get()),
+       failFunction->getArg(0), failFunction->getArg(1),
+       failFunction->getArg(2), failFunction->getArg(3)});
+  builder.CreateCall(exit, {builder.getInt32(70)});
+  builder.CreateUnreachable();
+  builder.ClearInsertionPoint();
+}
+
+// Variables are defined in the first shard, and only visible to the others
+// when there are any.
+auto Compiler::global(uint32_t index) -> Slot & {
+  auto &target = globals[index];
+  if (target.function || target.variable)
+    return target;
+
+  const auto &declaration = program.globals[index];
+  if (declaration.function)
+    target.function = declare(
+        std::get<Stmt::Function>(declaration.function->stmt),
+        llvm::Function::ExternalLinkage);
+  if (declaration.variable) {
+    auto name = std::get<Stmt::Var>(declaration.variable->stmt).name.lexeme();
+    auto shared = program.shards() > 1;
+    target.variable = new llvm::GlobalVariable(
+        *module, builder.getInt64Ty(), false,
+        shared ? llvm::GlobalValue::ExternalLinkage
+               : llvm::GlobalValue::InternalLinkage,
+        shard == 0 ? constant(nil) : nullptr,
+        "bds." + llvm::StringRef(name.data(), name.size()));
+  }
+  return target;
+}
+
+auto Compiler::open(const Stmt *owner, bool function) -> void {
+  auto found = resolution.slots.find(owner);
+  scopes.push_back({slots.size(), function});
+  slots.resize(slots.size() +
+               (found != resolution.slots.end() ? found->second : 0));
+}
+
+auto Compiler::close() -> void {
+  slots.resize(scopes.back().base);
+  scopes.pop_back();
+}
+
+auto Compiler::slot(Binding binding, const Token &name) -> Slot * {
+  if (binding.kind == Binding::Kind::Global)
+    return &global(binding.index);
+
+  size_t scope = scopes.size() - 1 - binding.depth;
+  auto &target = slots[scopes[scope].base + binding.index];
+  for (size_t i = scope + 1; i < scopes.size() && !target.function; i++) {
+    if (scopes[i].function) {
+      report(Error::Unsupported, name, "variables of enclosing functions");
+      return nullptr;
+    }
+  }
+  return &target;
+}
+
+auto Compiler::variable(const Expr *use, const Token &name) -> llvm::Value * {
+  auto *target = slot(resolution.uses.at(use), name);
+  if (target && target->function) {
+    report(Error::Unsupported, name, "functions as values");
+    return nullptr;
+  }
+  return target ? target->variable : nullptr;
+}
+
+auto Compiler::allocate(const Token &name) -> llvm::Value * {
+  auto &entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+  llvm::IRBuilder<> allocas(&entry, entry.begin());
+  auto text = name.lexeme();
+  return allocas.CreateAlloca(builder.getInt64Ty(), nullptr,
+                              llvm::StringRef(text.data(), text.size()));
+}
+
+auto Compiler::constant(uint64_t value) -> llvm::Constant * {
+  return builder.getInt64(value);
+}
+
+auto Compiler::boolean(llvm::Value *condition) -> llvm::Value * {
+  return builder.CreateOr(
+      builder.CreateZExt(condition, builder.getInt64Ty()),
+      constant(falseValue));
+}
+
+auto Compiler::truthy(llvm::Value *value) -> llvm::Value * {
+  return builder.CreateAnd(builder.CreateICmpNE(value, constant(nil)),
+                           builder.CreateICmpNE(value, constant(falseValue)));
+}
+
+auto Compiler::isNumber(llvm::Value *value) -> llvm::Value * {
+  return builder.CreateICmpNE(builder.CreateAnd(value, constant(quietNaN)),
+                              constant(quietNaN));
+}
+
+auto Compiler::toNumber(llvm::Value *value) -> llvm::Value * {
+  return builder.CreateBitCast(value, builder.getDoubleTy());
+}
+
+auto Compiler::fromNumber(llvm::Value *value) -> llvm::Value * {
+  return builder.CreateBitCast(value, builder.getInt64Ty());
+}
+
+auto Compiler::string(const Token &token) -> llvm::Value * {
+  if (token.symbol >= strings.size())
+    strings.resize(token.symbol + 1);
+  auto *&storage = strings[token.symbol];
+  auto text = token.lexeme();
+  if (!storage && program.shards() == 1) {
+    storage = builder.CreateGlobalStringPtr(
+        llvm::StringRef(text.data(), text.size()), ".str", 0, module.get());
+  } else if (!storage) {
+    // Every shard defines the literal under the same name, and the linker
+    // keeps one of them, so that it is the same string in all of them. The
+    // definitions are weak rather than linkonce, so that the lazy JIT's
+    // one-function modules do not drop the ones they do not use.
+    auto name = std::format(".str.{}", token.symbol);
+    auto *global = new llvm::GlobalVariable(
+        *module,
+        llvm::ArrayType::get(builder.getInt8Ty(), text.size() + 1), true,
+        llvm::GlobalValue::WeakODRLinkage,
+        llvm::ConstantDataArray::getString(
+            *context, llvm::StringRef(text.data(), text.size())),
+        name);
+    global->setComdat(module->getOrInsertComdat(name));
+    global->setAlignment(llvm::Align(1));
+    storage = global;
+  }
+  return builder.CreateOr(
+      builder.CreatePtrToInt(storage, builder.getInt64Ty()),
+      constant(stringTag));
+}
+
+auto Compiler::check(llvm::Value *condition, std::string_view message,
+                     const Token &token) -> void {
+  // Checks of constants fold away as they are built.
+  if (auto *known = llvm::dyn_cast<llvm::ConstantInt>(condition);
+      known && known->isOne())
+    return;
+
+  auto [file, row, column] = token.location();
+  if (!filename)
+    filename = builder.CreateGlobalStringPtr(
+        llvm::StringRef(file.data(), file.size()), ".file", 0, module.get());
+  auto *&text = messages[message];
+  if (!text)
+    text = builder.CreateGlobalStringPtr(
+        llvm::StringRef(message.data(), message.size()), ".message", 0,
+        module.get());
+
+  // Every check in a function fails into one block, which keeps the code
+  // small and bds.fail down to one call site per function.
+  auto *function = builder.GetInsertBlock()->getParent();
+  if (!failure.block) {
+    auto point = builder.saveIP();
+    failure.block = llvm::BasicBlock::Create(*context, "fail", function);
+    builder.SetInsertPoint(failure.block);
+    failure.message = builder.CreatePHI(builder.getInt8PtrTy(), 0, "message");
+    failure.row = builder.CreatePHI(builder.getInt32Ty(), 0, "row");
+    failure.column = builder.CreatePHI(builder.getInt32Ty(), 0, "column");
+    builder.CreateCall(failFunction, {failure.message, filename, failure.row,
+                                      failure.column});
+    builder.CreateUnreachable();
+    builder.restoreIP(point);
+  }
+
+  auto *next = llvm::BasicBlock::Create(*context, "checked", function);
+  builder.CreateCondBr(condition, next, failure.block);
+  failure.message->addIncoming(text, builder.GetInsertBlock());
+  failure.row->addIncoming(builder.getInt32(row), builder.GetInsertBlock());
+  failure.column->addIncoming(builder.getInt32(column),
+                              builder.GetInsertBlock());
+  builder.SetInsertPoint(next);
+}
+
+auto Compiler::unreachable() -> void {
+  auto *function = builder.GetInsertBlock()->getParent();
+  builder.SetInsertPoint(llvm::BasicBlock::Create(*context, "dead", function));
+}
+
+auto Compiler::report(Error::Type type, const Token &token, std::string arg)
+    -> llvm::Value * {
+  Error error{type, token, {}};
+  if (!arg.empty())
+    error.args.push_back(std::move(arg));
+  diagnostics.report(std::move(error));
+  return constant(nil);
+}
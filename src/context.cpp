@@ -0,0 +1,25 @@
+#include <context.hpp>
+
+#include <algorithm>
+#include <iterator>
+
+auto ASTContext::grow(size_t size) -> void {
+  // Chunks double up to 1 MiB; a node larger than that gets a chunk of its
+  // own size.
+  size_t capacity = std::max(chunkSize, size);
+  chunkSize = std::min<size_t>(chunkSize * 2, 1 << 20);
+
+  chunks.push_back(std::make_unique_for_overwrite<std::byte[]>(capacity));
+  cursor = chunks.back().get();
+  limit = cursor + capacity;
+}
+
+auto ASTContext::merge(ASTContext &&other) -> void {
+  chunks.insert(chunks.begin(), std::make_move_iterator(other.chunks.begin()),
+                std::make_move_iterator(other.chunks.end()));
+  used += other.used;
+
+  other.chunks.clear();
+  other.cursor = other.limit = nullptr;
+  other.used = 0;
+}
@@ -0,0 +1,135 @@
+#include <diagnostics.hpp>
+#include <output.hpp>
+#include <source.hpp>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+
+auto Diagnostics::parse(std::string_view name) -> std::optional<Format> {
+  if (name == "text")
+    return Format::Text;
+  if (name == "json")
+    return Format::Json;
+  return std::nullopt;
+}
+
+// An unterminated string or comment swallows the rest of the input, so any
+// error at the end of it only repeats that one and is dropped.
+auto Diagnostics::report(Error error) -> void {
+  if (unterminated && error.token.type == Token::Type::END)
+    return;
+  if (error.type == Error::UnterminatedString ||
+      error.type == Error::UnterminatedComment)
+    unterminated = true;
+
+  if (!full())
+    errors.push_back(std::move(error));
+}
+
+auto Diagnostics::merge(Diagnostics &&other) -> void {
+  errors.insert(errors.end(), std::make_move_iterator(other.errors.begin()),
+                std::make_move_iterator(other.errors.end()));
+  other.errors.clear();
+
+  unterminated |= other.unterminated;
+  if (unterminated)
+    std::erase_if(errors, [](const Error &error) {
+      return error.token.type == Token::Type::END;
+    });
+}
+
+// Errors are reported as they are found, and the parser can run a token or
+// two behind the lexer, so they are sorted before rendering.
+auto Diagnostics::sorted() const -> std::vector<const Error *> {
+  std::vector<const Error *> order;
+  order.reserve(errors.size());
+  for (const auto &error : errors)
+    order.push_back(&error);
+
+  std::ranges::stable_sort(order, [](const Error *a, const Error *b) {
+    return std::pair(a->token.file, a->token.offset) <
+           std::pair(b->token.file, b->token.offset);
+  });
+  order.resize(size());
+  return order;
+}
+
+auto Diagnostics::print(Format format) const -> void {
+  if (format == Format::Json) {
+    auto out = json();
+    fwrite(out.data(), 1, out.size(), stdout);
+    return;
+  }
+
+  for (const auto *error : sorted())
+    error->print();
+
+  if (full())
+    printf("Stopped after %zu error%s.\n", size(), size() == 1 ? "" : "s");
+  else if (size() > 1)
+    printf("%zu errors generated.\n", size());
+}
+
+static auto number(std::string &out, uint64_t value) -> void {
+  char buffer[20];
+  auto [end, error] = std::to_chars(buffer, buffer + sizeof buffer, value);
+  out.append(buffer, end);
+}
+
+// Errors come out sorted, so the filename is escaped once per file and the
+// row is found by walking forward through the line table rather than by a
+// search per error.
+auto Diagnostics::json() const -> std::string {
+  std::string out;
+  out.reserve(160 * size() + 64);
+  out += "{\"diagnostics\": [";
+
+  const Source *source = nullptr;
+  std::string filename;
+  size_t row = 0;
+
+  bool first = true;
+  for (const auto *error : sorted()) {
+    const auto &token = error->token;
+    if (source != &SourceManager::instance().get(token.file)) {
+      source = &SourceManager::instance().get(token.file);
+      filename.clear();
+      escape(filename, source->filename);
+      row = 0;
+    }
+    while (row < source->lines.size() && source->lines[row] <= token.offset)
+      row++;
+
+    out += first ? "\n" : ",\n";
+    out += "  {\"severity\": \"error\", \"message\": ";
+    escape(out, error->message());
+    out += ", \"args\": [";
+    for (size_t i = 0; i < error->args.size(); i++) {
+      if (i > 0)
+        out += ", ";
+      escape(out, error->args[i]);
+    }
+    out += "], \"file\": ";
+    out += filename;
+    out += ", \"line\": ";
+    number(out, row);
+    out += ", \"column\": ";
+    number(out, token.offset - source->lines[row - 1] + 1);
+    out += ", \"offset\": ";
+    number(out, token.offset);
+    out += ", \"length\": ";
+    number(out, token.length);
+    out += '}';
+    first = false;
+  }
+
+  out += "\n], \"count\": ";
+  number(out, size());
+  out += ", \"limit_reached\": ";
+  out += full() ? "true" : "false";
+  out += "}\n";
+  return out;
+}
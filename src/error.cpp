@@ -1,5 +1,7 @@
 #include <error.hpp>
+#include <source.hpp>
 
+#include <algorithm>
 #include <map>
 
 const std::map<Error::Type, std::string> errorMessages = {
@@ -10,12 +12,25 @@ const std::map<Error::Type, std::string> errorMessages = {
     {Error::InvalidAssignment, "Invalid assignment"},
     {Error::TooManyArguments, "Too many arguments"},
     {Error::TooManyParameters, "Too many parameters"},
+    {Error::NestingTooDeep, "Nesting too deep"},
+    {Error::UndefinedVariable, "Undefined variable"},
+    {Error::UseBeforeDefinition, "Use before definition"},
+    {Error::NotCallable, "Only functions can be called"},
+    {Error::ArityMismatch, "Wrong number of arguments"},
+    {Error::BreakOutsideLoop, "Break outside a loop"},
+    {Error::ReturnOutsideFunction, "Return outside a function"},
+    {Error::Unsupported, "Not supported yet"},
+    {Error::InvalidEdit, "Edit out of range"},
 };
 
-auto Error::print() -> void {
-  auto [filename, source, row, column] = token.location;
-  printf("\033[1;31mError:\033[0m %s at %s:%d:%d!",
-         errorMessages.at(type).data(), filename.data(), row, column);
+auto Error::message() const -> std::string_view {
+  return errorMessages.at(type);
+}
+
+auto Error::print() const -> void {
+  auto [filename, row, column] = token.location();
+  printf("\033[1;31mError:\033[0m %s at %.*s:%d:%d!", message().data(),
+         (int)filename.size(), filename.data(), row, column);
 
   for (auto arg : args)
     printf(" %s", arg.data());
@@ -23,9 +38,10 @@ auto Error::print() -> void {
   printf("\n");
 
   int n = printf("%4d ", row);
-  printf("|    %s\n%*s|%4s", source.data(), n, "", "");
-  n = column - token.lexeme.length() - 1;
+  auto line = SourceManager::instance().get(token.file).line(row);
+  printf("|    %.*s\n%*s|%4s", (int)line.size(), line.data(), n, "", "");
+  n = column - 1;
   printf("%*s\033[1;31m^", n, "");
-  n = token.lexeme.length() - 1;
+  n = std::min<int>(token.length, line.size() - n) - 1;
   printf("%s\033[0m\n", n > 0 ? std::string(n, '~').data() : "");
-}
\ No newline at end of file
+}
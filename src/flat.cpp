@@ -0,0 +1,263 @@
+#include <flat.hpp>
+#include <parser.hpp>
+
+#include <initializer_list>
+#include <variant>
+
+namespace {
+
+// Builds the tables in post-order without recursion. A node is visited twice:
+// first to schedule its children, then, once their ids are on the id stack,
+// to pop them and append the node itself. The result is laid out exactly as a
+// recursive build would lay it out.
+struct Builder {
+  using Node = std::variant<const Expr *, const Stmt *>;
+
+  struct Task {
+    Node node;
+    bool expanded;
+  };
+
+  FlatAST &ast;
+  std::vector<Task> tasks;
+  std::vector<NodeId> ids;
+
+  auto build(const Stmt *root) -> NodeId {
+    tasks.push_back({root, false});
+    while (!tasks.empty()) {
+      auto task = tasks.back();
+      tasks.pop_back();
+      std::visit([&](const auto *node) { visit(node, task.expanded); },
+                 task.node);
+    }
+    return pop();
+  }
+
+  template <class T> auto visit(const T *node, bool expanded) -> void {
+    if (!node) {
+      ids.push_back(FlatAST::none);
+    } else if (expanded) {
+      ids.push_back(node->accept([this](const auto &n) { return add(n); }));
+    } else {
+      tasks.push_back({node, true});
+      node->accept([this](const auto &n) { expand(n); });
+    }
+  }
+
+  // Schedules children so that they are built in the order given.
+  auto push(std::initializer_list<Node> nodes) -> void {
+    for (auto node = nodes.end(); node != nodes.begin();)
+      tasks.push_back({*--node, false});
+  }
+
+  template <class T> auto push(std::span<T *> nodes) -> void {
+    for (auto node = nodes.rbegin(); node != nodes.rend(); ++node)
+      tasks.push_back({*node, false});
+  }
+
+  auto pop() -> NodeId {
+    auto id = ids.back();
+    ids.pop_back();
+    return id;
+  }
+
+  // Moves the ids of the last count children into extra, optionally preceded
+  // by their count, and returns where they begin.
+  auto list(size_t count, bool counted) -> NodeId {
+    NodeId begin = ast.extra.size();
+    if (counted)
+      ast.extra.push_back(count);
+    ast.extra.insert(ast.extra.end(), ids.end() - count, ids.end());
+    ids.resize(ids.size() - count);
+    return begin;
+  }
+
+  auto token(const Token &token) -> uint32_t { return ast.addToken(token); }
+
+  auto expand(const Expr::Assign &expr) -> void { push({expr.value}); }
+  auto expand(const Expr::Binary &expr) -> void {
+    push({expr.left, expr.right});
+  }
+  auto expand(const Expr::Call &expr) -> void {
+    push(expr.arguments);
+    push({expr.callee});
+  }
+  auto expand(const Expr::Get &expr) -> void { push({expr.object}); }
+  auto expand(const Expr::Grouping &expr) -> void {
+    push({expr.expression});
+  }
+  auto expand(const Expr::Literal &) -> void {}
+  auto expand(const Expr::Logical &expr) -> void {
+    push({expr.left, expr.right});
+  }
+  auto expand(const Expr::Set &expr) -> void {
+    push({expr.object, expr.value});
+  }
+  auto expand(const Expr::This &) -> void {}
+  auto expand(const Expr::Unary &expr) -> void { push({expr.right}); }
+  auto expand(const Expr::Variable &) -> void {}
+
+  auto expand(const Stmt::Block &stmt) -> void { push(stmt.statements); }
+  auto expand(const Stmt::Break &) -> void {}
+  auto expand(const Stmt::Expression &stmt) -> void {
+    push({stmt.expression});
+  }
+  auto expand(const Stmt::Function &stmt) -> void {
+    push({Parser::body(stmt)});
+  }
+  auto expand(const Stmt::If &stmt) -> void {
+    push({stmt.condition, stmt.thenBranch, stmt.elseBranch});
+  }
+  auto expand(const Stmt::Print &stmt) -> void { push({stmt.expression}); }
+  auto expand(const Stmt::Return &stmt) -> void { push({stmt.value}); }
+  auto expand(const Stmt::Var &stmt) -> void { push({stmt.initializer}); }
+  auto expand(const Stmt::While &stmt) -> void {
+    push({stmt.condition, stmt.body});
+  }
+
+  auto add(const Expr::Assign &expr) -> NodeId {
+    auto value = pop();
+    return ast.add(FlatAST::Kind::Assign, token(expr.name), value);
+  }
+
+  auto add(const Expr::Binary &expr) -> NodeId {
+    auto right = pop();
+    auto left = pop();
+    return ast.add(FlatAST::Kind::Binary, token(expr.op), left, right);
+  }
+
+  auto add(const Expr::Call &expr) -> NodeId {
+    auto arguments = list(expr.arguments.size(), true);
+    auto callee = pop();
+    return ast.add(FlatAST::Kind::Call, token(expr.paren), callee, arguments);
+  }
+
+  auto add(const Expr::Get &expr) -> NodeId {
+    auto object = pop();
+    return ast.add(FlatAST::Kind::Get, token(expr.name), object);
+  }
+
+  auto add(const Expr::Grouping &) -> NodeId {
+    auto expression = pop();
+    return ast.add(FlatAST::Kind::Grouping, FlatAST::none, expression);
+  }
+
+  auto add(const Expr::Literal &expr) -> NodeId {
+    return ast.add(FlatAST::Kind::Literal, token(expr.value));
+  }
+
+  auto add(const Expr::Logical &expr) -> NodeId {
+    auto right = pop();
+    auto left = pop();
+    return ast.add(FlatAST::Kind::Logical, token(expr.op), left, right);
+  }
+
+  auto add(const Expr::Set &expr) -> NodeId {
+    auto value = pop();
+    auto object = pop();
+    return ast.add(FlatAST::Kind::Set, token(expr.name), object, value);
+  }
+
+  auto add(const Expr::This &expr) -> NodeId {
+    return ast.add(FlatAST::Kind::This, token(expr.keyword));
+  }
+
+  auto add(const Expr::Unary &expr) -> NodeId {
+    auto right = pop();
+    return ast.add(FlatAST::Kind::Unary, token(expr.op), right);
+  }
+
+  auto add(const Expr::Variable &expr) -> NodeId {
+    return ast.add(FlatAST::Kind::Variable, token(expr.name));
+  }
+
+  auto add(const Stmt::Block &stmt) -> NodeId {
+    auto begin = list(stmt.statements.size(), false);
+    return ast.add(FlatAST::Kind::Block, FlatAST::none, begin,
+                   ast.extra.size());
+  }
+
+  auto add(const Stmt::Break &stmt) -> NodeId {
+    return ast.add(FlatAST::Kind::Break, token(stmt.keyword));
+  }
+
+  auto add(const Stmt::Expression &) -> NodeId {
+    auto expression = pop();
+    return ast.add(FlatAST::Kind::Expression, FlatAST::none, expression);
+  }
+
+  auto add(const Stmt::Function &stmt) -> NodeId {
+    auto body = pop();
+    NodeId params = ast.extra.size();
+    ast.extra.push_back(stmt.params.size());
+    for (const auto &param : stmt.params)
+      ast.extra.push_back(token(param));
+    return ast.add(FlatAST::Kind::Function, token(stmt.name), params, body);
+  }
+
+  auto add(const Stmt::If &) -> NodeId {
+    auto elseBranch = pop();
+    auto thenBranch = pop();
+    auto condition = pop();
+    NodeId branches = ast.extra.size();
+    ast.extra.push_back(thenBranch);
+    ast.extra.push_back(elseBranch);
+    return ast.add(FlatAST::Kind::If, FlatAST::none, condition, branches);
+  }
+
+  auto add(const Stmt::Print &) -> NodeId {
+    auto expression = pop();
+    return ast.add(FlatAST::Kind::Print, FlatAST::none, expression);
+  }
+
+  auto add(const Stmt::Return &stmt) -> NodeId {
+    auto value = pop();
+    return ast.add(FlatAST::Kind::Return, token(stmt.keyword), value);
+  }
+
+  auto add(const Stmt::Var &stmt) -> NodeId {
+    auto initializer = pop();
+    return ast.add(FlatAST::Kind::Var, token(stmt.name), initializer);
+  }
+
+  auto add(const Stmt::While &) -> NodeId {
+    auto body = pop();
+    auto condition = pop();
+    return ast.add(FlatAST::Kind::While, FlatAST::none, condition, body);
+  }
+};
+
+} // namespace
+
+auto FlatAST::build(std::span<Stmt *const> statements) -> FlatAST {
+  FlatAST ast;
+  Builder builder{ast};
+  ast.roots.reserve(statements.size());
+  for (const auto *stmt : statements)
+    ast.roots.push_back(builder.build(stmt));
+  return ast;
+}
+
+auto FlatAST::list(NodeId node) const -> std::span<const uint32_t> {
+  if (kinds[node] == Kind::Call)
+    return {extra.data() + rhs[node] + 1, extra[rhs[node]]};
+  return {extra.data() + lhs[node], extra.data() + rhs[node]};
+}
+
+auto FlatAST::params(NodeId node) const -> std::span<const uint32_t> {
+  return {extra.data() + lhs[node] + 1, extra[lhs[node]]};
+}
+
+auto FlatAST::add(Kind kind, uint32_t token, uint32_t lhs, uint32_t rhs)
+    -> NodeId {
+  kinds.push_back(kind);
+  tokenIndices.push_back(token);
+  this->lhs.push_back(lhs);
+  this->rhs.push_back(rhs);
+  return kinds.size() - 1;
+}
+
+auto FlatAST::addToken(const Token &token) -> uint32_t {
+  tokens.push_back(token);
+  return tokens.size() - 1;
+}
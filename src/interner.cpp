@@ -0,0 +1,69 @@
+#include <interner.hpp>
+
+#include <bit>
+#include <functional>
+
+Interner::~Interner() {
+  for (auto &chunk : chunks)
+    delete[] chunk.load();
+}
+
+auto Interner::instance() -> Interner & {
+  static Interner interner;
+  return interner;
+}
+
+auto Interner::key(std::string_view text) -> Key {
+  return {text, std::hash<std::string_view>()(text)};
+}
+
+// Two threads may need the same chunk at once; the one that loses the race
+// frees its own.
+auto Interner::chunk(size_t index) -> std::string_view * {
+  auto *chunk = chunks[index].load(std::memory_order_acquire);
+  if (chunk)
+    return chunk;
+  auto *fresh = new std::string_view[size_t(1) << index];
+  if (chunks[index].compare_exchange_strong(chunk, fresh,
+                                            std::memory_order_acq_rel))
+    return fresh;
+  delete[] fresh;
+  return chunk;
+}
+
+auto Interner::intern(std::string_view text) -> Symbol {
+  auto key = this->key(text);
+  auto index = key.hash & ((1 << shardBits) - 1);
+  auto &shard = shards[index];
+  std::lock_guard lock(shard.mutex);
+  if (auto it = shard.symbols.find(key); it != shard.symbols.end())
+    return it->second;
+
+  // The deque never moves its strings, so the key and the chunk can view
+  // the stored copy. It is in the chunk before the lock is released, so
+  // any thread given the symbol can read it.
+  key.text = shard.texts.emplace_back(text);
+  Symbol symbol = next.fetch_add(1, std::memory_order_relaxed);
+  size_t position = size_t(symbol) + 1;
+  auto bits = std::bit_width(position) - 1;
+  chunk(bits)[position - (size_t(1) << bits)] = key.text;
+  shard.symbols.emplace(key, symbol);
+  return symbol;
+}
+
+auto Interner::find(std::string_view text) const -> Symbol {
+  auto key = this->key(text);
+  const auto &shard = shards[key.hash & ((1 << shardBits) - 1)];
+  std::lock_guard lock(shard.mutex);
+  auto it = shard.symbols.find(key);
+  return it != shard.symbols.end() ? it->second : none;
+}
+
+auto Interner::text(Symbol symbol) const -> std::string_view {
+  size_t position = size_t(symbol) + 1;
+  auto bits = std::bit_width(position) - 1;
+  return chunks[bits].load(
+      std::memory_order_acquire)[position - (size_t(1) << bits)];
+}
+
+auto Interner::size() const -> size_t { return next.load(); }
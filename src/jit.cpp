@@ -0,0 +1,82 @@
+#include <jit.hpp>
+
+#include <ranges>
+#include <vector>
+
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Support/Error.h>
+
+namespace {
+
+template <class T> auto message(llvm::Expected<T> &value) -> std::string {
+  return llvm::toString(value.takeError());
+}
+
+} // namespace
+
+auto Jit::run(const Backend &backend,
+              std::span<std::unique_ptr<Compiler>> shards)
+    -> std::expected<int, std::string> {
+  const auto &machine = *backend.machine;
+  llvm::orc::JITTargetMachineBuilder target(machine.getTargetTriple());
+  std::vector<std::string> features;
+  for (auto feature :
+       std::string_view(machine.getTargetFeatureString()) |
+           std::views::split(','))
+    if (!feature.empty())
+      features.emplace_back(feature.begin(), feature.end());
+  target.setCPU(machine.getTargetCPU().str())
+      .addFeatures(features)
+      .setCodeGenOptLevel(machine.getOptLevel());
+
+  auto jit =
+      llvm::orc::LLLazyJITBuilder().setJITTargetMachineBuilder(target).create();
+  if (!jit)
+    return std::unexpected(message(jit));
+
+  auto process =
+      llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          (*jit)->getDataLayout().getGlobalPrefix());
+  if (!process)
+    return std::unexpected(message(process));
+  (*jit)->getMainJITDylib().addGenerator(std::move(*process));
+
+  // Each function reaches this layer alone in a module of its own, so the
+  // optimizer only sees the functions that are called.
+  (*jit)->getIRTransformLayer().setTransform(
+      [&](llvm::orc::ThreadSafeModule partition,
+          llvm::orc::MaterializationResponsibility &)
+          -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+        partition.withModuleDo([&](llvm::Module &module) {
+          for (const auto &function : module)
+            compiled += !function.isDeclaration();
+          optimizer.run(module, backend.machine.get());
+        });
+        return partition;
+      });
+
+  for (auto &shard : shards) {
+    shard->module->setDataLayout((*jit)->getDataLayout());
+    for (const auto &function : *shard->module)
+      functions += !function.isDeclaration();
+    if (auto error = (*jit)->addLazyIRModule(llvm::orc::ThreadSafeModule(
+            std::move(shard->module), std::move(shard->context))))
+      return std::unexpected(llvm::toString(std::move(error)));
+  }
+
+  auto symbol = (*jit)->lookup("main");
+  if (!symbol)
+    return std::unexpected(message(symbol));
+#if LLVM_VERSION_MAJOR >= 17
+  auto *main = symbol->toPtr<int (*)()>();
+#else
+  auto *main = llvm::jitTargetAddressToFunction<int (*)()>(
+      symbol->getAddress());
+#endif
+  entered = std::chrono::steady_clock::now();
+  return main();
+}
@@ -1,28 +1,88 @@
+#include <interner.hpp>
 #include <lexer.hpp>
+#include <scan.hpp>
+#include <source.hpp>
 
-#include <map>
-
-std::map<char, Token::Type> singleTokens = {
-    {'(', Token::Type::LEFT_PAREN},   {')', Token::Type::RIGHT_PAREN},
-    {'{', Token::Type::LEFT_BRACE},   {'}', Token::Type::RIGHT_BRACE},
-    {'[', Token::Type::LEFT_BRACKET}, {']', Token::Type::RIGHT_BRACKET},
-    {';', Token::Type::SEMICOLON},    {',', Token::Type::COMMA},
-    {'.', Token::Type::DOT},          {'-', Token::Type::MINUS},
-    {'+', Token::Type::PLUS},         {'/', Token::Type::SLASH},
-    {'*', Token::Type::STAR},         {'%', Token::Type::MODULO},
-    {'!', Token::Type::BANG},         {'=', Token::Type::EQUAL},
-    {'<', Token::Type::LESS},         {'>', Token::Type::GREATER},
-    {'?', Token::Type::QUESTION},     {':', Token::Type::COLON},
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <future>
+#include <string>
+
+enum CharClass : uint8_t {
+  DIGIT = 1 << 0,
+  IDENTIFIER_START = 1 << 1,
 };
 
-std::map<std::string_view, Token::Type> doubleTokens = {
-    {"!=", Token::Type::BANG_EQUAL},    {"==", Token::Type::EQUAL_EQUAL},
-    {">=", Token::Type::GREATER_EQUAL}, {"<=", Token::Type::LESS_EQUAL},
-    {"++", Token::Type::PLUS_PLUS},     {"--", Token::Type::MINUS_MINUS},
-    {"->", Token::Type::ARROW},
+constexpr auto charClasses = [] {
+  std::array<uint8_t, 256> table{};
+  for (unsigned char c = '0'; c <= '9'; c++)
+    table[c] |= DIGIT;
+  for (unsigned char c = 'a'; c <= 'z'; c++)
+    table[c] |= IDENTIFIER_START;
+  for (unsigned char c = 'A'; c <= 'Z'; c++)
+    table[c] |= IDENTIFIER_START;
+  table['_'] |= IDENTIFIER_START;
+  return table;
+}();
+
+constexpr auto is(char c, CharClass charClass) -> bool {
+  return charClasses[static_cast<unsigned char>(c)] & charClass;
+}
+
+constexpr auto singleTokens = [] {
+  std::array<Token::Type, 256> table;
+  table.fill(Token::Type::ERROR);
+  table['('] = Token::Type::LEFT_PAREN;
+  table[')'] = Token::Type::RIGHT_PAREN;
+  table['{'] = Token::Type::LEFT_BRACE;
+  table['}'] = Token::Type::RIGHT_BRACE;
+  table['['] = Token::Type::LEFT_BRACKET;
+  table[']'] = Token::Type::RIGHT_BRACKET;
+  table[';'] = Token::Type::SEMICOLON;
+  table[','] = Token::Type::COMMA;
+  table['.'] = Token::Type::DOT;
+  table['-'] = Token::Type::MINUS;
+  table['+'] = Token::Type::PLUS;
+  table['/'] = Token::Type::SLASH;
+  table['*'] = Token::Type::STAR;
+  table['%'] = Token::Type::MODULO;
+  table['!'] = Token::Type::BANG;
+  table['='] = Token::Type::EQUAL;
+  table['<'] = Token::Type::LESS;
+  table['>'] = Token::Type::GREATER;
+  table['?'] = Token::Type::QUESTION;
+  table[':'] = Token::Type::COLON;
+  return table;
+}();
+
+constexpr auto doubleToken(char first, char second) -> Token::Type {
+  switch (first) {
+  case '!':
+    return second == '=' ? Token::Type::BANG_EQUAL : Token::Type::ERROR;
+  case '=':
+    return second == '=' ? Token::Type::EQUAL_EQUAL : Token::Type::ERROR;
+  case '>':
+    return second == '=' ? Token::Type::GREATER_EQUAL : Token::Type::ERROR;
+  case '<':
+    return second == '=' ? Token::Type::LESS_EQUAL : Token::Type::ERROR;
+  case '+':
+    return second == '+' ? Token::Type::PLUS_PLUS : Token::Type::ERROR;
+  case '-':
+    return second == '-'   ? Token::Type::MINUS_MINUS
+           : second == '>' ? Token::Type::ARROW
+                           : Token::Type::ERROR;
+  default:
+    return Token::Type::ERROR;
+  }
+}
+
+struct Keyword {
+  std::string_view text;
+  Token::Type type = Token::Type::IDENTIFIER;
 };
 
-std::map<std::string_view, Token::Type> keywords = {
+constexpr std::array<Keyword, 20> keywords = {{
     {"and", Token::Type::AND},       {"break", Token::Type::BREAK},
     {"do", Token::Type::DO},         {"else", Token::Type::ELSE},
     {"enum", Token::Type::ENUM},     {"false", Token::Type::FALSE},
@@ -32,35 +92,266 @@ std::map<std::string_view, Token::Type> keywords = {
     {"or", Token::Type::OR},         {"print", Token::Type::PRINT},
     {"return", Token::Type::RETURN}, {"self", Token::Type::SELF},
     {"skip", Token::Type::SKIP},     {"struct", Token::Type::STRUCT},
-    {"true", Token::Type::TRUE},     {"while", Token::Type::WHILE}};
+    {"true", Token::Type::TRUE},     {"while", Token::Type::WHILE},
+}};
 
-Lexer::Lexer(std::string_view filename, std::string_view source)
-    : filename(filename), source(source) {
-  tokens = std::vector<Token>();
+// Every keyword is 2 to 6 characters long and no two of them agree on
+// (first character, second character, length) under this hash, so each
+// slot of the table holds at most one keyword.
+constexpr auto keywordHash(std::string_view text) -> size_t {
+  return (static_cast<unsigned char>(text[0]) +
+          static_cast<unsigned char>(text[1]) * 18 + text.size() * 2) &
+         31;
 }
 
-auto Lexer::scanTokens() -> std::expected<std::vector<Token>, Error> {
-  while (!isAtEnd()) {
+constexpr auto keywordTable = [] {
+  std::array<Keyword, 32> table{};
+  for (auto keyword : keywords) {
+    auto &slot = table[keywordHash(keyword.text)];
+    if (!slot.text.empty())
+      throw "keyword hash collision";
+    slot = keyword;
+  }
+  return table;
+}();
+
+constexpr auto keyword(std::string_view text) -> Token::Type {
+  if (text.size() < 2 || text.size() > 6)
+    return Token::Type::IDENTIFIER;
+
+  const auto &slot = keywordTable[keywordHash(text)];
+  return slot.text == text ? slot.type : Token::Type::IDENTIFIER;
+}
+
+static_assert(keyword("while") == Token::Type::WHILE);
+static_assert(keyword("whale") == Token::Type::IDENTIFIER);
+
+Lexer::Lexer(uint32_t file)
+    : file(file), source(SourceManager::instance().get(file).text),
+      limit(source.size()) {}
+
+Lexer::Lexer(uint32_t file, uint32_t begin, uint32_t limit)
+    : file(file), source(SourceManager::instance().get(file).text),
+      current(begin), limit(limit) {}
+
+auto Lexer::next() -> std::expected<Token, Error> {
+  while (current < limit) {
     start = current;
     auto token = scanToken();
     if (!token)
       return std::unexpected(token.error());
 
     if (*token)
-      tokens.push_back(**token);
+      return **token;
+  }
+
+  return newToken(Token::Type::END, current, 0);
+}
+
+auto Lexer::scanTokens() -> std::expected<std::vector<Token>, Error> {
+  return scanSequential(nullptr);
+}
+
+auto Lexer::scanTokens(unsigned threads)
+    -> std::expected<std::vector<Token>, Error> {
+  return scanParallel(threads, nullptr);
+}
+
+auto Lexer::scanTokens(Diagnostics &diagnostics, unsigned threads)
+    -> std::vector<Token> {
+  return *scanParallel(threads, &diagnostics);
+}
+
+// Every error skips the input it was found in: a bad character, or the rest
+// of the file for an unterminated string or comment. Lexing can always carry
+// on after reporting it.
+auto Lexer::scanSequential(Diagnostics *diagnostics)
+    -> std::expected<std::vector<Token>, Error> {
+  std::vector<Token> tokens;
+
+  while (true) {
+    auto token = next();
+    if (!token) {
+      if (!diagnostics)
+        return std::unexpected(token.error());
+
+      diagnostics->report(token.error());
+      if (diagnostics->full())
+        token = newToken(Token::Type::END, current, 0);
+      else
+        continue;
+    }
+
+    tokens.push_back(*token);
+    if (token->type == Token::Type::END)
+      return tokens;
+  }
+}
+
+// Splits the source after newlines and lexes each chunk on its own thread,
+// assuming the chunk does not start inside a string or block comment. A
+// lexer that begins on a token boundary produces exactly the sequential
+// tokens, so the chunks are validated in order: a chunk is kept only if
+// the previous one stopped exactly where it begins, and is relexed from
+// where the previous one stopped otherwise. From the first chunk with an
+// error on, the rest of the source is lexed sequentially.
+auto Lexer::scanParallel(unsigned threads, Diagnostics *diagnostics)
+    -> std::expected<std::vector<Token>, Error> {
+  constexpr uint32_t minChunk = 1 << 16;
+
+  uint32_t size = source.size();
+  unsigned chunks = std::min<uint32_t>(threads, size / minChunk);
+  if (chunks <= 1 || current != 0 || limit != size)
+    return scanSequential(diagnostics);
+
+  std::vector<uint32_t> boundaries = {0};
+  for (unsigned i = 1; i < chunks; i++) {
+    uint32_t target =
+        std::max<uint32_t>(boundaries.back(), uint64_t(size) * i / chunks);
+    auto newline = scan::find(source.data() + target, end(), '\n');
+    if (newline + 1 >= end())
+      break;
+    boundaries.push_back(newline + 1 - source.data());
+  }
+  boundaries.push_back(size);
+
+  struct Chunk {
+    std::expected<std::vector<Token>, Error> tokens;
+    uint32_t stop;
+  };
+
+  auto lexChunk = [file = file](uint32_t begin, uint32_t limit) -> Chunk {
+    Lexer lexer(file, begin, limit);
+    std::vector<Token> tokens;
+    while (true) {
+      auto token = lexer.next();
+      if (!token)
+        return {std::unexpected(token.error()), lexer.current};
+      if (token->type == Token::Type::END)
+        return {std::move(tokens), lexer.current};
+      tokens.push_back(*token);
+    }
+  };
+
+  std::vector<std::future<Chunk>> futures;
+  for (size_t i = 0; i + 1 < boundaries.size(); i++)
+    futures.push_back(std::async(std::launch::async, lexChunk, boundaries[i],
+                                 boundaries[i + 1]));
+
+  std::vector<Token> tokens;
+  uint32_t position = 0;
+  for (size_t i = 0; i < futures.size(); i++) {
+    auto chunk = futures[i].get();
+    if (position >= boundaries[i + 1])
+      continue;
+    if (position != boundaries[i])
+      chunk = lexChunk(position, boundaries[i + 1]);
+
+    if (!chunk.tokens) {
+      if (!diagnostics)
+        return std::unexpected(chunk.tokens.error());
+
+      auto rest = *Lexer(file, position, size).scanSequential(diagnostics);
+      tokens.insert(tokens.end(), rest.begin(), rest.end());
+      return tokens;
+    }
+
+    tokens.insert(tokens.end(), chunk.tokens->begin(), chunk.tokens->end());
+    position = chunk.stop;
   }
-  tokens.push_back(newToken(Token::Type::END, ""));
+  tokens.push_back(newToken(Token::Type::END, size, 0));
 
   return tokens;
 }
 
+// The bytes a token was scanned from; strings exclude their quotes from the
+// lexeme but not from the scan.
+static auto scanBegin(const Token &token) -> uint32_t {
+  return token.offset - (token.type == Token::Type::STRING);
+}
+
+static auto scanEnd(const Token &token) -> uint32_t {
+  return token.offset + token.length + (token.type == Token::Type::STRING);
+}
+
+// Applies the edit to the token's source and patches a complete token
+// stream for it. A token that ends before the edit never read any edited
+// byte, so lexing restarts where the last such token ends (which also
+// rescans any comment between it and the edit). It stops as soon as a new
+// token starts past the edit at the same place as an old one: from there
+// on the input is unchanged, so the old tokens only need shifting.
+//
+// An edit outside the source is an error that changes nothing. So is an
+// edit that leaves the source unlexable: the source is put back as it was,
+// so that it still matches tokens, and the error points at the same place
+// in the original text.
+auto Lexer::relex(std::vector<Token> tokens, Edit edit)
+    -> std::expected<Relex, Error> {
+  uint32_t file = tokens.back().file;
+  auto &source = SourceManager::instance().get(file);
+  uint32_t size = source.text.size();
+  if (edit.offset > size || edit.length > size - edit.offset)
+    return std::unexpected(
+        Error(Error::InvalidEdit,
+              Token(Token::Type::END, file, std::min(edit.offset, size), 0),
+              {}));
+
+  int64_t delta = int64_t(edit.text.size()) - edit.length;
+  uint32_t editEnd = edit.offset + edit.text.size();
+
+  auto first = std::partition_point(
+      tokens.begin(), tokens.end() - 1,
+      [&](const Token &token) { return scanEnd(token) < edit.offset; });
+  uint32_t restart = first == tokens.begin() ? 0 : scanEnd(*(first - 1));
+
+  std::string replaced(source.text.substr(edit.offset, edit.length));
+  source.replace(edit.offset, edit.length, edit.text);
+
+  Lexer lexer(file, restart, source.text.size());
+  std::vector<Token> inserted;
+  auto old = first;
+  while (true) {
+    auto token = lexer.next();
+    if (!token) {
+      source.replace(edit.offset, edit.text.size(), replaced);
+      auto error = token.error();
+      auto &offset = error.token.offset;
+      if (offset >= editEnd)
+        offset -= delta;
+      else if (offset > edit.offset)
+        offset = edit.offset;
+      error.token.length = std::min(error.token.length, size - offset);
+      return std::unexpected(error);
+    }
+
+    uint32_t begin = scanBegin(*token);
+    if (begin >= editEnd) {
+      while (scanBegin(*old) + delta < begin)
+        old++;
+      if (scanBegin(*old) + delta == begin)
+        break;
+    }
+
+    inserted.push_back(*token);
+  }
+
+  size_t index = first - tokens.begin();
+  size_t removed = old - first;
+  for (auto token = old; token != tokens.end(); token++)
+    token->offset += delta;
+
+  tokens.erase(first, old);
+  tokens.insert(tokens.begin() + index, inserted.begin(), inserted.end());
+
+  return Relex{std::move(tokens), index, removed, inserted.size()};
+}
+
 auto Lexer::isAtEnd() -> bool { return current >= source.size(); }
 
 auto Lexer::advance() -> char {
   if (isAtEnd())
     return '\0';
   current++;
-  column++;
   return source[current - 1];
 }
 
@@ -76,39 +367,28 @@ auto Lexer::peekNext() -> char {
   return source[current + 1];
 }
 
-auto Lexer::getline() -> std::string { return getline(row); }
+auto Lexer::cursor() -> const char * { return source.data() + current; }
 
-auto Lexer::getline(int n) -> std::string {
-  int line = 1;
-  int start = 0;
-  int end = 0;
-  for (int i = 0; i < source.size(); i++) {
-    if (source[i + 1] == '\0') {
-      end = i + 1;
-      break;
-    }
-    if (source[i] == '\n') {
-      line++;
-      if (line == n) {
-        start = i + 1;
-      } else if (line == n + 1) {
-        end = i;
-        break;
-      }
-    }
-  }
-  return std::string{source.substr(start, end - start)};
+auto Lexer::end() -> const char * { return source.data() + source.size(); }
+
+auto Lexer::seek(const char *position) -> void {
+  current = position - source.data();
 }
 
-auto Lexer::newToken(Token::Type type, std::string_view lexeme) -> Token {
-  return Token(type, std::string{lexeme}, filename, getline(), row, column);
+auto Lexer::newToken(Token::Type type) -> Token {
+  return Token(type, file, start, current - start);
+}
+
+auto Lexer::newToken(Token::Type type, uint32_t offset, uint32_t length)
+    -> Token {
+  return Token(type, file, offset, length);
 }
 
 auto Lexer::scanToken() -> std::expected<std::optional<Token>, Error> {
-  std::string possibleDoubleToken{peek(), peekNext()};
-  if (doubleTokens.find(possibleDoubleToken) != doubleTokens.end()) {
+  if (auto type = doubleToken(peek(), peekNext());
+      type != Token::Type::ERROR) {
     current += 2;
-    return newToken(doubleTokens[possibleDoubleToken], possibleDoubleToken);
+    return newToken(type);
   }
 
   char c = advance();
@@ -116,94 +396,89 @@ auto Lexer::scanToken() -> std::expected<std::optional<Token>, Error> {
   case ' ':
   case '\r':
   case '\t':
-    break;
   case '\n':
-    row++;
-    column = 1;
+    // Whitespace never runs past the limit, so a lexer working on one chunk
+    // of the source stops exactly at the chunk end unless a token or
+    // comment crosses it.
+    seek(scan::whitespace(cursor(), source.data() + limit));
     break;
   case '#':
-    while (peek() != '\n' && !isAtEnd())
-      advance();
+    seek(scan::find(cursor(), end(), '\n'));
     break;
   case '/': {
     switch (peek()) {
     case '/':
-      while (peek() != '\n' && !isAtEnd())
-        advance();
+      seek(scan::find(cursor(), end(), '\n'));
       break;
     case '*': {
-      auto token = newToken(Token::Type::SLASH, "");
-
-      while (!isAtEnd()) {
-        if (peek() == '\n') {
-          row++;
-          column = 1;
-        }
-        if (peek() == '*' && peekNext() == '/') {
-          advance();
-          advance();
-          break;
-        }
-        advance();
-        if (isAtEnd()) {
-          return std::unexpected(Error(Error::UnterminatedComment, token, {}));
-        }
+      auto token = newToken(Token::Type::SLASH);
+
+      auto close = scan::commentEnd(cursor(), end());
+      if (close == end()) {
+        seek(end());
+        return std::unexpected(Error(Error::UnterminatedComment, token, {}));
       }
+
+      seek(close + 2);
     } break;
     default:
-      return newToken(Token::Type::SLASH, "");
+      return newToken(Token::Type::SLASH);
       break;
     }
   } break;
   default:
-    if (singleTokens.find(c) != singleTokens.end())
-      return newToken(singleTokens[c], std::string{c});
+    if (auto type = singleTokens[static_cast<unsigned char>(c)];
+        type != Token::Type::ERROR)
+      return newToken(type);
 
-    if (isalpha(c) || c == '_') {
-      while (isalpha(peek()) || isdigit(peek()) || peek() == '_')
-        advance();
-
-      std::string_view text = source.substr(start, current - start);
-      if (keywords.find(text) != keywords.end())
-        return newToken(keywords[text], text);
+    if (is(c, IDENTIFIER_START)) {
+      seek(scan::identifier(cursor(), end()));
 
-      return newToken(Token::Type::IDENTIFIER, text);
+      auto text = source.substr(start, current - start);
+      auto token = newToken(keyword(text));
+      if (token.type == Token::Type::IDENTIFIER)
+        token.symbol = Interner::instance().intern(text);
+      return token;
     }
 
-    if (isdigit(c)) {
-      while (isdigit(peek()))
+    if (is(c, DIGIT)) {
+      while (is(peek(), DIGIT))
         advance();
 
       if (peek() == '.') {
         advance();
-        while (isdigit(peek()))
+        while (is(peek(), DIGIT))
           advance();
       }
 
-      std::string_view text = source.substr(start, current - start);
-      return newToken(Token::Type::NUMBER, text);
+      return newToken(Token::Type::NUMBER);
     }
 
     if (c == '"') {
-      auto token = newToken(Token::Type::QUOTE, std::string{c});
-
-      while (peek() != '"') {
-        if (isAtEnd())
-          return std::unexpected(Error(Error::UnterminatedString, token, {}));
+      auto token = newToken(Token::Type::QUOTE);
 
-        if (peek() == '\n') {
-          row++;
-          column = 1;
-        }
-        advance();
+      auto close = scan::find(cursor(), end(), '"');
+      if (close == end()) {
+        seek(end());
+        return std::unexpected(Error(Error::UnterminatedString, token, {}));
       }
 
-      advance();
+      seek(close + 1);
 
-      std::string_view text = source.substr(start + 1, current - start - 2);
-      return newToken(Token::Type::STRING, text);
+      auto string =
+          newToken(Token::Type::STRING, start + 1, current - start - 2);
+      string.symbol = Interner::instance().intern(
+          source.substr(string.offset, string.length));
+      return string;
     }
-    break;
+
+    // A multi-byte UTF-8 sequence is reported once, as a whole.
+    if (c & 0x80)
+      while ((peek() & 0xc0) == 0x80)
+        advance();
+
+    return std::unexpected(
+        Error(Error::UnexpectedCharacter, newToken(Token::Type::ERROR), {}));
   }
 
   return std::nullopt;
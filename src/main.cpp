@@ -1,42 +1,287 @@
+#include <backend.hpp>
+#include <cache.hpp>
+#include <callgraph.hpp>
+#include <codegen.hpp>
+#include <context.hpp>
+#include <diagnostics.hpp>
+#include <flat.hpp>
+#include <jit.hpp>
 #include <lexer.hpp>
+#include <optimizer.hpp>
+#include <options.hpp>
+#include <parallel.hpp>
 #include <parser.hpp>
 #include <printer.hpp>
+#include <source.hpp>
 
-#include <fstream>
+#include <chrono>
+#include <filesystem>
+#include <format>
 #include <iostream>
+#include <optional>
+#include <vector>
+
+#include <llvm/Support/raw_ostream.h>
 
 auto main(int argc, const char *argv[]) -> int {
-  if (argc == 2) {
-    std::string filename = argv[1];
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-      std::cout << "Could not open file " << filename << std::endl;
-      return 1;
+  auto launched = std::chrono::steady_clock::now();
+  auto options = Options::parse(argc, argv);
+  if (!options) {
+    std::cout << options.error() << std::endl;
+    std::cout << "Usage: bds [--stats] [--threads=N] [--max-nesting=N] "
+                 "[--lazy-bodies] [--cache-dir=DIR] [--error-limit=N] "
+                 "[--diagnostics-format=text|json] "
+                 "[--ast-format=sexpr|json|tree] [--emit-llvm] "
+                 "[-O0|-O1|-O2|-O3|-Os|-Oz] [--print-after-all] "
+                 "[--time-passes] [--run] [-c|-S] [-o FILE] "
+                 "[-march=CPU|native] [-mattr=+F,-F] [script | -]"
+              << std::endl;
+    return 1;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto id = SourceManager::instance().load(options->filename);
+  if (!id) {
+    std::cout << "Could not open file " << options->filename << std::endl;
+    return 1;
+  }
+  std::chrono::duration<double, std::milli> io =
+      std::chrono::steady_clock::now() - start;
+  auto printIo = [&] {
+    const auto &source = SourceManager::instance().get(*id);
+    std::cerr << std::format("io: {:.3f} ms, {} bytes ({})\n", io.count(),
+                             source.text.size(),
+                             source.mapping ? "mmap" : "read");
+  };
+
+  // Like clang, -c and -S stop at an object or assembly file, or at bitcode
+  // or IR with --emit-llvm, and -o alone links an executable. Without any of
+  // them the IR is printed, or else the AST. --run compiles the program in
+  // memory and runs it straight away.
+  auto compiling = options->run || options->emitLlvm ||
+                   options->compileOnly || options->assemblyOnly ||
+                   !options->output.empty();
+  auto output = Backend::Output::Executable;
+  std::string extension;
+  if (options->emitLlvm && options->compileOnly && !options->assemblyOnly)
+    output = Backend::Output::Bitcode, extension = ".bc";
+  else if (options->emitLlvm)
+    output = Backend::Output::Llvm, extension = ".ll";
+  else if (options->assemblyOnly)
+    output = Backend::Output::Assembly, extension = ".s";
+  else if (options->compileOnly)
+    output = Backend::Output::Object, extension = ".o";
+  auto path = options->output;
+  if (path.empty())
+    path = options->emitLlvm && !options->compileOnly && !options->assemblyOnly
+               ? "-"
+               : std::filesystem::path(options->filename)
+                     .filename()
+                     .replace_extension(extension)
+                     .string();
+
+  // A hit skips lexing and parsing altogether. Only sources that parse
+  // without errors are ever stored. Code generation needs the full AST, so
+  // it bypasses the cache.
+  std::optional<Cache> cache;
+  if (!options->cacheDir.empty() && !compiling) {
+    start = std::chrono::steady_clock::now();
+    cache.emplace(options->cacheDir, *id, options->maxNesting);
+    if (auto ast = cache->load()) {
+      std::chrono::duration<double, std::milli> load =
+          std::chrono::steady_clock::now() - start;
+      Printer(options->astFormat).print(*ast);
+      if (options->stats) {
+        printIo();
+        std::cerr << std::format("cache: hit, {:.3f} ms to load {}\n",
+                                 load.count(), cache->entry().string());
+      }
+      return 0;
     }
+  }
+
+  Lexer lexer(*id);
+  Diagnostics diagnostics(options->errorLimit);
+  Diagnostics lexDiagnostics(options->errorLimit);
+  ASTContext context;
+  std::optional<Parser> parser;
+  std::chrono::duration<double, std::milli> lex{};
+  std::chrono::duration<double, std::milli> parse{};
+  if (options->threads > 1) {
+    start = std::chrono::steady_clock::now();
+    // The whole file is lexed before parsing, so its errors are collected
+    // apart and merged with the parser's afterwards.
+    auto tokens = lexer.scanTokens(lexDiagnostics, options->threads);
+    lex = std::chrono::steady_clock::now() - start;
+    parser.emplace(std::move(tokens), context, options->maxNesting,
+                   options->lazyBodies);
+  } else {
+    parser.emplace(lexer, context, options->maxNesting, options->lazyBodies);
+  }
 
-    std::string source{std::istreambuf_iterator<char>(file),
-                       std::istreambuf_iterator<char>()};
+  start = std::chrono::steady_clock::now();
+  auto statements = parser->parseTokens(diagnostics, options->threads);
+  parse = std::chrono::steady_clock::now() - start;
+  diagnostics.merge(std::move(lexDiagnostics));
+  // Skipped bodies are parsed before any output, so that their errors are
+  // reported instead of it, like those of an eager parse. Compiling only
+  // needs the bodies reachable from main, until there are errors to report
+  // anyway and all of them are parsed so that all of theirs are reported.
+  if (options->lazyBodies) {
+    if (compiling)
+      reachable(statements, "main");
+    if (!compiling || !diagnostics.empty())
+      for (const auto *stmt : statements) {
+        if (!stmt)
+          continue;
+        if (auto *function = std::get_if<Stmt::Function>(&stmt->stmt))
+          Parser::body(*function);
+      }
+  }
+  if (!diagnostics.empty()) {
+    diagnostics.print(options->diagnosticsFormat);
+    return 1;
+  }
 
-    Lexer lexer(filename, source);
-    auto tokens = lexer.scanTokens();
-    if (!tokens) {
-      tokens.error().print();
+  if (compiling) {
+    auto backend = Backend::create(options->cpu, options->features,
+                                   options->optimization);
+    if (!backend) {
+      std::cout << backend.error() << std::endl;
       return 1;
     }
 
-    Parser parser(filename, *tokens);
-    auto statements = parser.parseTokens();
-    if (!statements) {
-      statements.error().print();
+    // Shards are lowered, optimized and emitted on --threads threads, except
+    // that printing after every pass keeps to one so that the dumps do not
+    // interleave.
+    auto threads = options->printAfterAll ? 1 : options->threads;
+    start = std::chrono::steady_clock::now();
+    Program program(statements, diagnostics);
+    if (!diagnostics.empty()) {
+      diagnostics.print(options->diagnosticsFormat);
       return 1;
     }
+    // Naming values takes a good part of code generation, and the names
+    // only show in printed IR.
+    auto shards = program.compile(diagnostics, options->filename, threads,
+                                  options->emitLlvm || options->printAfterAll);
+    std::chrono::duration<double, std::milli> codegen =
+        std::chrono::steady_clock::now() - start;
+    if (!diagnostics.empty()) {
+      diagnostics.print(options->diagnosticsFormat);
+      return 1;
+    }
+    size_t functions = 0;
+    std::vector<llvm::Module *> modules;
+    for (const auto &shard : shards) {
+      backend->prepare(*shard->module);
+      functions += shard->module->size();
+      modules.push_back(shard->module.get());
+    }
+
+    Optimizer optimizer{options->optimization, options->printAfterAll,
+                        options->timePasses};
+    auto printPasses = [&] {
+      if (!options->timePasses)
+        return;
+      double total = 0;
+      for (const auto &timing : optimizer.timings)
+        total += timing.milliseconds;
+      std::cerr << std::format("passes: {:.3f} ms\n", total);
+      for (const auto &timing : optimizer.timings)
+        std::cerr << std::format("  {:9.3f} ms  {:5.1f}%  {} ({} runs)\n",
+                                 timing.milliseconds,
+                                 total ? 100 * timing.milliseconds / total : 0,
+                                 timing.pass, timing.runs);
+    };
+    auto printCodegen = [&] {
+      printIo();
+      std::cerr << std::format(
+          "codegen: {:.3f} ms, {} functions in {} modules, {} threads\n",
+          codegen.count(), functions, modules.size(), threads);
+    };
+
+    if (options->run) {
+      Jit jit{optimizer};
+      auto status = jit.run(*backend, shards);
+      if (!status) {
+        std::cout << status.error() << std::endl;
+        return 1;
+      }
+      printPasses();
+      if (options->stats) {
+        printCodegen();
+        std::chrono::duration<double, std::milli> first =
+            jit.entered - launched;
+        std::cerr << std::format(
+            "jit: {:.3f} ms to first instruction, {} of {} functions "
+            "compiled at -O{}\n",
+            first.count(), jit.compiled, jit.functions,
+            Optimizer::name(options->optimization));
+      }
+      return *status;
+    }
+
+    start = std::chrono::steady_clock::now();
+    std::vector<Optimizer> optimizers(modules.size(), optimizer);
+    parallel(modules.size(), threads, [&](size_t i) {
+      auto local = backend->copy();
+      optimizers[i].run(*modules[i], local.machine.get());
+    });
+    for (const auto &shard : optimizers)
+      optimizer.merge(shard);
+    std::chrono::duration<double, std::milli> optimize =
+        std::chrono::steady_clock::now() - start;
+
+    start = std::chrono::steady_clock::now();
+    if (auto emitted = backend->emit(modules, output, path, threads);
+        !emitted) {
+      std::cout << emitted.error() << std::endl;
+      return 1;
+    }
+    std::chrono::duration<double, std::milli> emit =
+        std::chrono::steady_clock::now() - start;
+
+    printPasses();
+    if (options->stats) {
+      printCodegen();
+      std::cerr << std::format("optimize: {:.3f} ms at -O{}\n",
+                               optimize.count(),
+                               Optimizer::name(options->optimization));
+      std::cerr << std::format(
+          "emit: {:.3f} ms, {} for {} ({})\n", emit.count(),
+          Backend::name(output), backend->machine->getTargetTriple().str(),
+          backend->machine->getTargetCPU().str());
+    }
+    return 0;
+  }
 
-    Printer printer;
-    printer.print(std::move(*statements));
+  Printer printer(options->astFormat);
+  std::chrono::duration<double, std::milli> store{};
+  if (cache) {
+    start = std::chrono::steady_clock::now();
+    auto ast = FlatAST::build(statements);
+    if (!cache->store(ast))
+      std::cerr << "Could not write " << cache->entry().string() << std::endl;
+    store = std::chrono::steady_clock::now() - start;
+    printer.print(ast);
   } else {
-    std::cout << "Usage: bds [script]" << std::endl;
-    return 1;
+    printer.print(statements);
+  }
+
+  if (options->stats) {
+    printIo();
+    if (cache)
+      std::cerr << std::format(
+          "cache: miss, {:.3f} ms to parse, {:.3f} ms to store {}\n",
+          (lex + parse).count(), store.count(), cache->entry().string());
+    if (options->threads > 1) {
+      std::cerr << std::format("lex: {:.3f} ms, {} threads\n", lex.count(),
+                               options->threads);
+      std::cerr << std::format("parse: {:.3f} ms, {} threads\n",
+                               parse.count(), options->threads);
+    }
   }
 
   return 0;
-}
\ No newline at end of file
+}
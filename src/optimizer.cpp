@@ -0,0 +1,212 @@
+#include <optimizer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#include <llvm/ADT/Any.h>
+#include <llvm/Analysis/LazyCallGraph.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/PassInstrumentation.h>
+#include <llvm/Passes/OptimizationLevel.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/raw_ostream.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Times passes and analyses on a stack, so that the time of the ones a pass
+// runs is taken out of its own. Pass managers and adaptors only run other
+// passes and are not timed at all.
+struct PassTimer {
+  struct Frame {
+    size_t timing;
+    Clock::time_point start;
+    Clock::duration nested{};
+  };
+
+  std::vector<Optimizer::Timing> &timings;
+  std::unordered_map<std::string, size_t> indices;
+  std::vector<Frame> frames;
+
+  static auto manager(llvm::StringRef pass) -> bool {
+    return pass.contains("PassManager") || pass.contains("PassAdaptor");
+  }
+
+  auto start(llvm::StringRef pass) -> void {
+    if (manager(pass))
+      return;
+    auto [index, added] = indices.try_emplace(pass.str(), timings.size());
+    if (added)
+      timings.push_back({pass.str()});
+    frames.push_back({index->second, Clock::now()});
+  }
+
+  auto stop(llvm::StringRef pass) -> void {
+    if (manager(pass) || frames.empty())
+      return;
+    auto frame = frames.back();
+    frames.pop_back();
+    auto elapsed = Clock::now() - frame.start;
+    if (!frames.empty())
+      frames.back().nested += elapsed;
+    auto &timing = timings[frame.timing];
+    timing.milliseconds +=
+        std::chrono::duration<double, std::milli>(elapsed - frame.nested)
+            .count();
+    timing.runs++;
+  }
+};
+
+// The unit of IR a pass ran on, if it is a T. Before LLVM 16 any_cast
+// asserts on a mismatch instead of returning null.
+template <class T> auto unit(const llvm::Any &ir) -> const T * {
+#if LLVM_VERSION_MAJOR >= 16
+  const auto *unit = llvm::any_cast<const T *>(&ir);
+  return unit ? *unit : nullptr;
+#else
+  return llvm::any_isa<const T *>(ir) ? llvm::any_cast<const T *>(ir)
+                                      : nullptr;
+#endif
+}
+
+auto print(llvm::StringRef pass, const llvm::Any &ir) -> void {
+  auto &out = llvm::errs();
+  if (const auto *module = unit<llvm::Module>(ir)) {
+    out << "; *** IR Dump After " << pass << " on module ***\n";
+    module->print(out, nullptr);
+  } else if (const auto *function = unit<llvm::Function>(ir)) {
+    out << "; *** IR Dump After " << pass << " on " << function->getName()
+        << " ***\n";
+    function->print(out);
+  } else if (const auto *scc = unit<llvm::LazyCallGraph::SCC>(ir)) {
+    out << "; *** IR Dump After " << pass << " on " << scc->getName()
+        << " ***\n";
+    for (const auto &node : *scc)
+      node.getFunction().print(out);
+  } else if (const auto *loop = unit<llvm::Loop>(ir)) {
+    llvm::printLoop(const_cast<llvm::Loop &>(*loop), out,
+                    ("; *** IR Dump After " + pass + " ***").str());
+  }
+}
+
+auto optimization(Optimizer::Level level) -> llvm::OptimizationLevel {
+  switch (level) {
+  case Optimizer::Level::O0:
+    return llvm::OptimizationLevel::O0;
+  case Optimizer::Level::O1:
+    return llvm::OptimizationLevel::O1;
+  case Optimizer::Level::O2:
+    return llvm::OptimizationLevel::O2;
+  case Optimizer::Level::O3:
+    return llvm::OptimizationLevel::O3;
+  case Optimizer::Level::Os:
+    return llvm::OptimizationLevel::Os;
+  case Optimizer::Level::Oz:
+    return llvm::OptimizationLevel::Oz;
+  }
+  return llvm::OptimizationLevel::O0;
+}
+
+} // namespace
+
+auto Optimizer::parse(std::string_view name) -> std::optional<Level> {
+  for (auto level : {Level::O0, Level::O1, Level::O2, Level::O3, Level::Os,
+                     Level::Oz})
+    if (Optimizer::name(level) == name)
+      return level;
+  return std::nullopt;
+}
+
+auto Optimizer::name(Level level) -> std::string_view {
+  switch (level) {
+  case Level::O0:
+    return "0";
+  case Level::O1:
+    return "1";
+  case Level::O2:
+    return "2";
+  case Level::O3:
+    return "3";
+  case Level::Os:
+    return "s";
+  case Level::Oz:
+    return "z";
+  }
+  return "0";
+}
+
+auto Optimizer::run(llvm::Module &module, llvm::TargetMachine *machine)
+    -> void {
+  llvm::PassInstrumentationCallbacks callbacks;
+  // Timings add up over every module the optimizer runs on.
+  PassTimer timer{timings};
+  for (size_t i = 0; i < timings.size(); i++)
+    timer.indices.emplace(timings[i].pass, i);
+  if (timePasses) {
+    callbacks.registerBeforeNonSkippedPassCallback(
+        [&](llvm::StringRef pass, llvm::Any) { timer.start(pass); });
+    callbacks.registerAfterPassCallback(
+        [&](llvm::StringRef pass, llvm::Any, const llvm::PreservedAnalyses &) {
+          timer.stop(pass);
+        });
+    callbacks.registerAfterPassInvalidatedCallback(
+        [&](llvm::StringRef pass, const llvm::PreservedAnalyses &) {
+          timer.stop(pass);
+        });
+    callbacks.registerBeforeAnalysisCallback(
+        [&](llvm::StringRef pass, llvm::Any) { timer.start(pass); });
+    callbacks.registerAfterAnalysisCallback(
+        [&](llvm::StringRef pass, llvm::Any) { timer.stop(pass); });
+  }
+  if (printAfterAll) {
+    callbacks.registerAfterPassCallback(
+        [](llvm::StringRef pass, llvm::Any ir,
+           const llvm::PreservedAnalyses &) {
+          if (!PassTimer::manager(pass))
+            print(pass, ir);
+        });
+  }
+
+  // Like clang, vectorize loops from -O2 and at -Os, and straight-line code
+  // from -O2.
+  llvm::PipelineTuningOptions tuning;
+  tuning.LoopVectorization =
+      level == Level::O2 || level == Level::O3 || level == Level::Os;
+  tuning.SLPVectorization = level == Level::O2 || level == Level::O3;
+
+  llvm::LoopAnalysisManager loops;
+  llvm::FunctionAnalysisManager functions;
+  llvm::CGSCCAnalysisManager sccs;
+  llvm::ModuleAnalysisManager modules;
+  llvm::PassBuilder builder(machine, tuning, {}, &callbacks);
+  builder.registerModuleAnalyses(modules);
+  builder.registerCGSCCAnalyses(sccs);
+  builder.registerFunctionAnalyses(functions);
+  builder.registerLoopAnalyses(loops);
+  builder.crossRegisterProxies(loops, functions, sccs, modules);
+
+  auto passes = level == Level::O0
+                    ? builder.buildO0DefaultPipeline(optimization(level))
+                    : builder.buildPerModuleDefaultPipeline(
+                          optimization(level));
+  passes.run(module, modules);
+
+  std::ranges::sort(timings, std::ranges::greater(), &Timing::milliseconds);
+}
+
+auto Optimizer::merge(const Optimizer &other) -> void {
+  for (const auto &timing : other.timings) {
+    auto found = std::ranges::find(timings, timing.pass, &Timing::pass);
+    if (found == timings.end()) {
+      timings.push_back(timing);
+    } else {
+      found->milliseconds += timing.milliseconds;
+      found->runs += timing.runs;
+    }
+  }
+  std::ranges::sort(timings, std::ranges::greater(), &Timing::milliseconds);
+}
@@ -0,0 +1,104 @@
+#include <options.hpp>
+
+#include <charconv>
+#include <format>
+#include <string_view>
+
+auto Options::parse(int argc, const char *argv[])
+    -> std::expected<Options, std::string> {
+  Options options;
+  bool hasFilename = false;
+
+  for (int i = 1; i < argc; i++) {
+    std::string_view arg = argv[i];
+
+    if (arg == "--stats") {
+      options.stats = true;
+    } else if (arg.starts_with("--threads=")) {
+      auto value = arg.substr(arg.find('=') + 1);
+      auto [end, error] = std::from_chars(
+          value.data(), value.data() + value.size(), options.threads);
+      if (error != std::errc() || end != value.data() + value.size() ||
+          options.threads == 0)
+        return std::unexpected(std::format("Invalid thread count {}", value));
+    } else if (arg.starts_with("--max-nesting=")) {
+      auto value = arg.substr(arg.find('=') + 1);
+      auto [end, error] = std::from_chars(
+          value.data(), value.data() + value.size(), options.maxNesting);
+      if (error != std::errc() || end != value.data() + value.size() ||
+          options.maxNesting == 0)
+        return std::unexpected(std::format("Invalid nesting limit {}", value));
+    } else if (arg == "--lazy-bodies") {
+      options.lazyBodies = true;
+    } else if (arg.starts_with("--cache-dir=")) {
+      options.cacheDir = arg.substr(arg.find('=') + 1);
+      if (options.cacheDir.empty())
+        return std::unexpected("Missing cache directory");
+    } else if (arg.starts_with("--error-limit=")) {
+      auto value = arg.substr(arg.find('=') + 1);
+      auto [end, error] = std::from_chars(
+          value.data(), value.data() + value.size(), options.errorLimit);
+      if (error != std::errc() || end != value.data() + value.size())
+        return std::unexpected(std::format("Invalid error limit {}", value));
+    } else if (arg.starts_with("--diagnostics-format=")) {
+      auto value = arg.substr(arg.find('=') + 1);
+      auto format = Diagnostics::parse(value);
+      if (!format)
+        return std::unexpected(
+            std::format("Unknown diagnostics format {}", value));
+      options.diagnosticsFormat = *format;
+    } else if (arg.starts_with("--ast-format=")) {
+      auto value = arg.substr(arg.find('=') + 1);
+      auto format = Printer::parse(value);
+      if (!format)
+        return std::unexpected(std::format("Unknown AST format {}", value));
+      options.astFormat = *format;
+    } else if (arg == "--emit-llvm") {
+      options.emitLlvm = true;
+    } else if (arg.starts_with("-O")) {
+      auto level = Optimizer::parse(arg.substr(2));
+      if (!level)
+        return std::unexpected(
+            std::format("Unknown optimization level {}", arg));
+      options.optimization = *level;
+    } else if (arg == "--print-after-all") {
+      options.printAfterAll = true;
+    } else if (arg == "--time-passes") {
+      options.timePasses = true;
+    } else if (arg == "--run") {
+      options.run = true;
+    } else if (arg == "-c") {
+      options.compileOnly = true;
+    } else if (arg == "-S") {
+      options.assemblyOnly = true;
+    } else if (arg == "-o") {
+      if (++i == argc)
+        return std::unexpected("Missing output file");
+      options.output = argv[i];
+    } else if (arg.starts_with("-o")) {
+      options.output = arg.substr(2);
+    } else if (arg.starts_with("-march=") || arg.starts_with("-mcpu=")) {
+      options.cpu = arg.substr(arg.find('=') + 1);
+      if (options.cpu.empty())
+        return std::unexpected("Missing CPU");
+    } else if (arg.starts_with("-mattr=")) {
+      options.features = arg.substr(arg.find('=') + 1);
+    } else if (arg.starts_with("-") && arg != "-") {
+      return std::unexpected(std::format("Unknown option {}", arg));
+    } else if (hasFilename) {
+      return std::unexpected(std::format("Unexpected argument {}", arg));
+    } else {
+      options.filename = arg;
+      hasFilename = true;
+    }
+  }
+
+  if (!hasFilename)
+    return std::unexpected("Missing script");
+  if (options.run && (options.emitLlvm || options.compileOnly ||
+                      options.assemblyOnly || !options.output.empty()))
+    return std::unexpected(
+        "--run cannot be combined with --emit-llvm, -c, -S or -o");
+
+  return options;
+}
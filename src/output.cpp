@@ -0,0 +1,88 @@
+#include <output.hpp>
+
+#include <algorithm>
+#include <format>
+#include <iterator>
+
+auto escape(std::string &out, std::string_view text) -> void {
+  out += '"';
+  for (char c : text) {
+    switch (c) {
+    case '"':
+      out += "\\\"";
+      break;
+    case '\\':
+      out += "\\\\";
+      break;
+    case '\n':
+      out += "\\n";
+      break;
+    case '\t':
+      out += "\\t";
+      break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+        std::format_to(std::back_inserter(out), "\\u{:04x}", int(c));
+      else
+        out += c;
+    }
+  }
+  out += '"';
+}
+
+auto Output::reserve(size_t size) -> void {
+  if (stream) {
+    drain();
+    if (buffer.size() < size)
+      buffer.resize(size);
+  } else {
+    buffer.resize(std::max(2 * buffer.size(), used + size));
+  }
+}
+
+// Deep trees indent by more than a block, so long runs go out a block at a
+// time.
+auto Output::spaces(size_t count) -> void {
+  while (count > 0) {
+    if (used == buffer.size())
+      reserve(std::min(count, blockSize));
+    auto n = std::min(count, buffer.size() - used);
+    std::fill_n(buffer.data() + used, n, ' ');
+    used += n;
+    count -= n;
+  }
+}
+
+// Text that needs no escaping, which is nearly all of it, is copied as is.
+auto Output::escaped(std::string_view text) -> void {
+  if (std::ranges::none_of(text, [](char c) {
+        return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+      })) {
+    write('"');
+    write(text);
+    write('"');
+    return;
+  }
+  std::string quoted;
+  escape(quoted, text);
+  write(quoted);
+}
+
+auto Output::drain() -> void {
+  if (stream && used > 0) {
+    stream->write(buffer.data(), used);
+    used = 0;
+  }
+}
+
+auto Output::flush() -> void {
+  drain();
+  if (stream)
+    stream->flush();
+}
+
+auto Output::text() -> std::string {
+  buffer.resize(used);
+  used = 0;
+  return std::move(buffer);
+}
@@ -1,7 +1,12 @@
 #include <error.hpp>
 #include <parser.hpp>
+#include <source.hpp>
 
+#include <algorithm>
+#include <format>
+#include <future>
 #include <map>
+#include <span>
 #include <variant>
 
 std::map<Token::Type, std::string> expectedTokens = {
@@ -41,23 +46,218 @@ std::map<Token::Type, std::string> expectedTokens = {
     {Token::Type::NUMBER, "number"},
     {Token::Type::END, "end of file"}};
 
-Parser::Parser(std::string_view filename, std::vector<Token> tokens)
-    : filename(filename), tokens(tokens) {}
+const std::array<Parser::Precedence, size_t(Token::Type::END) + 1>
+    Parser::infixPrecedence = [] {
+      std::array<Precedence, size_t(Token::Type::END) + 1> table{};
+      table[size_t(Token::Type::EQUAL)] = Assignment;
+      table[size_t(Token::Type::OR)] = Or;
+      table[size_t(Token::Type::AND)] = And;
+      table[size_t(Token::Type::BANG_EQUAL)] = Equality;
+      table[size_t(Token::Type::EQUAL_EQUAL)] = Equality;
+      table[size_t(Token::Type::GREATER)] = Comparison;
+      table[size_t(Token::Type::GREATER_EQUAL)] = Comparison;
+      table[size_t(Token::Type::LESS)] = Comparison;
+      table[size_t(Token::Type::LESS_EQUAL)] = Comparison;
+      table[size_t(Token::Type::MINUS)] = Term;
+      table[size_t(Token::Type::PLUS)] = Term;
+      table[size_t(Token::Type::SLASH)] = Factor;
+      table[size_t(Token::Type::STAR)] = Factor;
+      table[size_t(Token::Type::MODULO)] = Factor;
+      table[size_t(Token::Type::LEFT_PAREN)] = Call;
+      return table;
+    }();
+
+Parser::Parser(Lexer &lexer, ASTContext &context, size_t maxDepth,
+               bool lazyBodies)
+    : lexer(&lexer), context(&context), maxDepth(maxDepth),
+      lazyBodies(lazyBodies) {}
+
+Parser::Parser(std::vector<Token> tokens, ASTContext &context,
+               size_t maxDepth, bool lazyBodies)
+    : tokens(std::move(tokens)), view(this->tokens), end(this->tokens.back()),
+      context(&context), maxDepth(maxDepth), lazyBodies(lazyBodies) {}
+
+Parser::Parser(std::span<const Token> tokens, Token end, ASTContext &context,
+               size_t maxDepth, bool lazyBodies)
+    : view(tokens), end(end), context(&context), maxDepth(maxDepth),
+      lazyBodies(lazyBodies) {}
+
+auto Parser::parseTokens() -> std::expected<std::vector<Stmt *>, Error> {
+  return parseSequential();
+}
+
+auto Parser::parseTokens(unsigned threads)
+    -> std::expected<std::vector<Stmt *>, Error> {
+  return parseParallel(threads);
+}
 
-auto Parser::parseTokens()
-    -> std::expected<std::vector<std::unique_ptr<Stmt>>, Error> {
+auto Parser::parseTokens(Diagnostics &diagnostics, unsigned threads)
+    -> std::vector<Stmt *> {
+  this->diagnostics = &diagnostics;
+  lexDiagnostics = Diagnostics(diagnostics.limit());
+  auto statements = parseParallel(threads);
+  return statements ? std::move(*statements) : std::vector<Stmt *>();
+}
+
+// Without diagnostics parsing stops at the first error. With them, every
+// error is reported and declaration() has already synchronized past it, so
+// parsing carries on with the next declaration until diagnostics are full.
+auto Parser::parseSequential() -> std::expected<std::vector<Stmt *>, Error> {
   while (!isAtEnd()) {
     auto statement = declaration();
-    if (!statement)
-      return std::unexpected(statement.error());
+    if (!statement) {
+      auto error = statement.error().token.type == Token::Type::ERROR
+                       ? *lexError
+                       : statement.error();
+      if (!diagnostics)
+        return std::unexpected(std::move(error));
+
+      diagnostics->report(std::move(error));
+      if (diagnostics->full())
+        break;
+      continue;
+    }
 
-    statements.push_back(std::move(*statement));
+    statements.push_back(*statement);
   }
 
+  if (diagnostics)
+    diagnostics->merge(std::move(lexDiagnostics));
+
+  if (lexError && !diagnostics)
+    return std::unexpected(*lexError);
+
   return std::move(statements);
 }
 
-auto Parser::isAtEnd() -> bool { return peek().type == Token::Type::END; }
+// Splits the tokens before top-level fn declarations that follow a closing
+// brace and parses each range on its own thread, into a context of its own.
+// A range that parses without error holds exactly the declarations the
+// sequential parser finds there: at the end of a range the parser only asks
+// whether the next token continues what it has parsed, and neither fn nor
+// the end of the range does. Ranges are therefore kept in order up to the
+// first one that fails, and everything from there on is parsed again
+// sequentially so that the same errors are reported.
+auto Parser::parseParallel(unsigned threads)
+    -> std::expected<std::vector<Stmt *>, Error> {
+  constexpr size_t minRange = 1 << 14;
+
+  if (lexer || current != 0 || threads <= 1)
+    return parseSequential();
+
+  size_t size = view.size() - 1;
+  unsigned ranges = std::min<size_t>(threads, size / minRange);
+  if (ranges <= 1)
+    return parseSequential();
+
+  std::vector<size_t> boundaries = {0};
+  int depth = 0;
+  for (size_t i = 1; i < size && boundaries.size() < ranges; i++) {
+    auto type = view[i - 1].type;
+    depth += type == Token::Type::LEFT_BRACE || type == Token::Type::LEFT_PAREN;
+    depth -=
+        type == Token::Type::RIGHT_BRACE || type == Token::Type::RIGHT_PAREN;
+    bool boundary = depth == 0 && type == Token::Type::RIGHT_BRACE &&
+                    view[i].type == Token::Type::FN;
+    if (boundary && i >= size * boundaries.size() / ranges)
+      boundaries.push_back(i);
+  }
+  boundaries.push_back(size);
+
+  struct Range {
+    ASTContext context;
+    std::expected<std::vector<Stmt *>, Error> statements;
+  };
+
+  auto parseRange = [this](size_t begin, size_t limit) -> Range {
+    Range range;
+    Token stop(Token::Type::END, view[limit].file, view[limit].offset, 0);
+    range.statements = Parser(view.subspan(begin, limit - begin), stop,
+                              range.context, maxDepth, lazyBodies)
+                           .parseTokens();
+    return range;
+  };
+
+  std::vector<std::future<Range>> futures;
+  for (size_t i = 0; i + 1 < boundaries.size(); i++)
+    futures.push_back(std::async(std::launch::async, parseRange, boundaries[i],
+                                 boundaries[i + 1]));
+
+  for (size_t i = 0; i < futures.size(); i++) {
+    auto range = futures[i].get();
+    if (!range.statements) {
+      Parser parser(view.subspan(boundaries[i]), end, *context, maxDepth,
+                    lazyBodies);
+      parser.diagnostics = diagnostics;
+      auto rest = parser.parseSequential();
+      if (!rest)
+        return std::unexpected(rest.error());
+      statements.insert(statements.end(), rest->begin(), rest->end());
+      return std::move(statements);
+    }
+
+    context->merge(std::move(range.context));
+    statements.insert(statements.end(), range.statements->begin(),
+                      range.statements->end());
+
+    // Skipped bodies are parsed later, into the context that now owns them.
+    for (auto *stmt : *range.statements) {
+      if (!stmt)
+        continue;
+      if (auto *function = std::get_if<Stmt::Function>(&stmt->stmt);
+          function && function->lazy) {
+        function->lazy->context = context;
+        function->lazy->diagnostics = diagnostics;
+      }
+    }
+  }
+
+  return std::move(statements);
+}
+
+auto Parser::fetch() -> Token {
+  if (!lexer)
+    return fetched < view.size() ? view[fetched] : end;
+
+  // Once lexing has stopped the stream stays on the token it ended with:
+  // ERROR, which the grammar never accepts, or END when diagnostics are
+  // full.
+  if (lexError)
+    return at(fetched - 1);
+
+  // Lexing errors are reported as they come, and the lexer has already
+  // skipped past the bad input. Once they are full the stream ends there,
+  // just as Lexer::scanTokens(Diagnostics &) would end it.
+  auto token = lexer->next();
+  while (!token && diagnostics) {
+    lexDiagnostics.report(token.error());
+    if (lexDiagnostics.full()) {
+      lexError = token.error();
+      return Token(Token::Type::END, lexError->token.file, lexer->position(),
+                   0);
+    }
+    token = lexer->next();
+  }
+  if (token)
+    return *token;
+
+  lexError = token.error();
+  const auto &bad = token.error().token;
+  return Token(Token::Type::ERROR, bad.file, bad.offset, bad.length);
+}
+
+auto Parser::at(size_t index) -> Token {
+  while (fetched <= index) {
+    auto token = fetch();
+    window[fetched++ % window.size()] = token;
+  }
+  return window[index % window.size()];
+}
+
+auto Parser::isAtEnd() -> bool {
+  auto type = peek().type;
+  return type == Token::Type::END || type == Token::Type::ERROR;
+}
 
 auto Parser::advance() -> Token {
   if (!isAtEnd())
@@ -65,15 +265,11 @@ auto Parser::advance() -> Token {
   return previous();
 }
 
-auto Parser::peek() -> Token { return tokens[current]; }
+auto Parser::peek() -> Token { return at(current); }
 
-auto Parser::peekNext() -> Token {
-  if (current + 1 >= tokens.size())
-    return tokens[tokens.size() - 1];
-  return tokens[current + 1];
-}
+auto Parser::peekNext() -> Token { return at(current + 1); }
 
-auto Parser::previous() -> Token { return tokens[current - 1]; }
+auto Parser::previous() -> Token { return at(current - 1); }
 
 auto Parser::check(Token::Type type) -> bool {
   if (isAtEnd())
@@ -99,11 +295,23 @@ auto Parser::consume(Token::Type type) -> std::expected<Token, Error> {
       Error{Error::UnexpectedToken, peek(), {expectedTokens[type]}});
 }
 
+// Skips the rest of a statement: up to a semicolon or a braced block that
+// ends it, or to a keyword or closing brace that cannot belong to it. The
+// token at the error is always skipped, so that parsing moves on.
 auto Parser::synchronize() -> void {
-  advance();
-
+  size_t depth = 0;
   while (!isAtEnd()) {
-    if (previous().type == Token::Type::SEMICOLON)
+    auto type = advance().type;
+    if (type == Token::Type::LEFT_BRACE) {
+      depth++;
+      continue;
+    }
+    if (type == Token::Type::RIGHT_BRACE && depth > 0 && --depth == 0 &&
+        !check(Token::Type::ELSE))
+      return;
+    if (depth > 0)
+      continue;
+    if (type == Token::Type::SEMICOLON)
       return;
 
     switch (peek().type) {
@@ -114,343 +322,480 @@ auto Parser::synchronize() -> void {
     case Token::Type::WHILE:
     case Token::Type::PRINT:
     case Token::Type::RETURN:
+    case Token::Type::RIGHT_BRACE:
       return;
     default:
-      advance();
+      break;
     }
   }
 }
 
-auto Parser::expression() -> std::expected<std::unique_ptr<Expr>, Error> {
-  return assignment();
+auto Parser::nest(Token token) -> std::expected<void, Error> {
+  if (exprFrames.size() + stmtFrames.size() < maxDepth)
+    return {};
+
+  return std::unexpected(Error{
+      Error::NestingTooDeep, token, {std::format("(limit {})", maxDepth)}});
 }
 
-auto Parser::assignment() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = logicalOr();
-  if (!expr)
-    return std::unexpected(expr.error());
+// Pratt parsing on an explicit stack. Operands are parsed by descending
+// through prefix operators and parentheses, pushing a frame for each. After
+// an operand, every operator that binds at least as tightly as precedence
+// is folded in; when none does, the frame on top is finished instead.
+// Left-associative operators parse their right operand one level higher;
+// assignment is right-associative and parses it at its own level.
+auto Parser::expression() -> std::expected<Expr *, Error> {
+  size_t bottom = exprFrames.size();
+  size_t base = exprStack.size();
+  auto fail = [&](Error error) {
+    exprFrames.resize(bottom);
+    exprStack.resize(base);
+    return std::unexpected(std::move(error));
+  };
+
+  Precedence precedence = Assignment;
+  Expr *expr = nullptr;
 
-  if (match({Token::Type::EQUAL})) {
-    auto equals = previous();
-    auto value = assignment();
-    if (!value)
-      return std::unexpected(value.error());
-
-    if (auto *var = (*expr)->get<Expr::Variable>()) {
-      Token name = var->name;
-      return std::make_unique<Expr>(
-          std::move(Expr::Assign(name, std::move(*value))));
-    } else if (auto *get = (*expr)->get<Expr::Get>()) {
-      return std::make_unique<Expr>(std::move(
-          Expr::Set(std::move(get->object), get->name, std::move(*value))));
+  while (true) {
+    if (!expr) {
+      auto token = peek();
+      switch (token.type) {
+      case Token::Type::FALSE:
+      case Token::Type::TRUE:
+      case Token::Type::NUMBER:
+      case Token::Type::STRING:
+        advance();
+        expr = context->create<Expr>(Expr::Literal(token));
+        continue;
+
+      case Token::Type::IDENTIFIER:
+        advance();
+        expr = context->create<Expr>(Expr::Variable(token));
+        continue;
+
+      case Token::Type::BANG:
+      case Token::Type::MINUS:
+      case Token::Type::LEFT_PAREN: {
+        if (auto nested = nest(token); !nested)
+          return fail(nested.error());
+        advance();
+
+        bool unary = token.type != Token::Type::LEFT_PAREN;
+        exprFrames.push_back({unary ? ExprFrame::Unary : ExprFrame::Grouping,
+                              precedence, token});
+        precedence = unary ? Unary : Assignment;
+        continue;
+      }
+
+      default:
+        return fail(
+            Error{Error::UnexpectedToken, token, {"primary expression"}});
+      }
     }
 
-    return std::unexpected(Error{Error::InvalidAssignment, peek(), {}});
-  }
-
-  return expr;
-}
-
-auto Parser::logicalOr() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = logicalAnd();
-  if (!expr)
-    return std::unexpected(expr.error());
+    auto op = peek();
+    auto infix = infixPrecedence[size_t(op.type)];
+    if (infix != None && infix >= precedence) {
+      advance();
+      if (op.type == Token::Type::LEFT_PAREN &&
+          check(Token::Type::RIGHT_PAREN)) {
+        expr = context->create<Expr>(Expr::Call(expr, advance(), {}));
+        continue;
+      }
+
+      if (auto nested = nest(op); !nested)
+        return fail(nested.error());
+
+      auto kind = op.type == Token::Type::LEFT_PAREN ? ExprFrame::Call
+                  : op.type == Token::Type::EQUAL    ? ExprFrame::Assign
+                                                     : ExprFrame::Binary;
+      exprFrames.push_back({kind, precedence, op, expr, exprStack.size()});
+      precedence =
+          kind == ExprFrame::Binary ? Precedence(infix + 1) : Assignment;
+      expr = nullptr;
+      continue;
+    }
 
-  while (match({Token::Type::OR})) {
-    auto op = previous();
-    auto right = logicalAnd();
-    if (!right)
-      return std::unexpected(right.error());
+    if (exprFrames.size() == bottom)
+      return expr;
 
-    expr = std::make_unique<Expr>(std::move(
-        Expr::Logical(std::move(*expr), std::move(op), std::move(*right))));
-  }
+    auto &frame = exprFrames.back();
+    switch (frame.kind) {
+    case ExprFrame::Unary:
+      expr = context->create<Expr>(Expr::Unary(frame.op, expr));
+      break;
 
-  return expr;
-}
+    case ExprFrame::Grouping: {
+      auto paren = consume(Token::Type::RIGHT_PAREN);
+      if (!paren)
+        return fail(paren.error());
 
-auto Parser::logicalAnd() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = equality();
-  if (!expr)
-    return std::unexpected(expr.error());
+      expr = context->create<Expr>(Expr::Grouping(expr));
+      break;
+    }
 
-  while (match({Token::Type::AND})) {
-    auto op = previous();
-    auto right = equality();
-    if (!right)
-      return std::unexpected(right.error());
+    case ExprFrame::Binary:
+      if (auto logical = infixPrecedence[size_t(frame.op.type)];
+          logical == Or || logical == And)
+        expr = context->create<Expr>(Expr::Logical(frame.left, frame.op, expr));
+      else
+        expr = context->create<Expr>(Expr::Binary(frame.left, frame.op, expr));
+      break;
 
-    expr = std::make_unique<Expr>(std::move(
-        Expr::Logical(std::move(*expr), std::move(op), std::move(*right))));
-  }
+    case ExprFrame::Assign:
+      if (auto *var = frame.left->get<Expr::Variable>())
+        expr = context->create<Expr>(Expr::Assign(var->name, expr));
+      else if (auto *get = frame.left->get<Expr::Get>())
+        expr = context->create<Expr>(Expr::Set(get->object, get->name, expr));
+      else
+        return fail(Error{Error::InvalidAssignment, peek(), {}});
+      break;
 
-  return expr;
-}
+    case ExprFrame::Call: {
+      auto call = finishCall(frame, expr);
+      if (!call)
+        return fail(call.error());
 
-auto Parser::equality() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = comparison();
-  if (!expr)
-    return std::unexpected(expr.error());
+      // Another argument follows.
+      if (!*call) {
+        precedence = Assignment;
+        expr = nullptr;
+        continue;
+      }
 
-  while (match({Token::Type::BANG_EQUAL, Token::Type::EQUAL_EQUAL})) {
-    auto op = previous();
-    auto right = comparison();
-    if (!right)
-      return std::unexpected(right.error());
+      expr = *call;
+      break;
+    }
+    }
 
-    expr = std::make_unique<Expr>(std::move(
-        Expr::Binary(std::move(*expr), std::move(op), std::move(*right))));
+    precedence = frame.precedence;
+    exprFrames.pop_back();
   }
-
-  return expr;
 }
 
-auto Parser::comparison() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = addition();
-  if (!expr)
-    return std::unexpected(expr.error());
-
-  while (match({Token::Type::GREATER, Token::Type::GREATER_EQUAL,
-                Token::Type::LESS, Token::Type::LESS_EQUAL})) {
-    auto op = previous();
-    auto right = addition();
-    if (!right)
-      return std::unexpected(right.error());
+// Adds an argument to the call in frame. Returns the finished call, or
+// nullptr if another argument follows.
+auto Parser::finishCall(ExprFrame &frame, Expr *argument)
+    -> std::expected<Expr *, Error> {
+  exprStack.push_back(argument);
 
-    expr = std::make_unique<Expr>(std::move(
-        Expr::Binary(std::move(*expr), std::move(op), std::move(*right))));
+  if (match({Token::Type::COMMA})) {
+    if (exprStack.size() - frame.base >= 255)
+      return std::unexpected(Error{Error::TooManyArguments, peek(), {}});
+    return nullptr;
   }
 
-  return expr;
-}
-
-auto Parser::addition() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = multiplication();
-  if (!expr)
-    return std::unexpected(expr.error());
-
-  while (match({Token::Type::MINUS, Token::Type::PLUS})) {
-    auto op = previous();
-    auto right = multiplication();
-    if (!right)
-      return std::unexpected(right.error());
+  auto paren = consume(Token::Type::RIGHT_PAREN);
+  if (!paren)
+    return std::unexpected(paren.error());
 
-    expr = std::make_unique<Expr>(std::move(
-        Expr::Binary(std::move(*expr), std::move(op), std::move(*right))));
-  }
+  auto arguments =
+      context->copy(std::span<Expr *const>(exprStack).subspan(frame.base));
+  exprStack.resize(frame.base);
 
-  return expr;
+  return context->create<Expr>(Expr::Call(frame.left, *paren, arguments));
 }
 
-auto Parser::multiplication() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = unary();
-  if (!expr)
-    return std::unexpected(expr.error());
-
-  while (match({Token::Type::SLASH, Token::Type::STAR, Token::Type::MODULO})) {
-    auto op = previous();
-    auto right = unary();
-    if (!right)
-      return std::unexpected(right.error());
-
-    expr = std::make_unique<Expr>(std::move(
-        Expr::Binary(std::move(*expr), std::move(op), std::move(*right))));
-  }
-
-  return expr;
-}
+// With diagnostics, an error inside a block is reported and only the frames
+// opened inside that block are dropped; the rest of the statement is skipped
+// and parsing goes on with the block's next statement, so that one mistake
+// is reported once. Anywhere else, and at the end of the input, the whole
+// declaration is abandoned.
+auto Parser::declaration() -> std::expected<Stmt *, Error> {
+  size_t bottom = stmtFrames.size();
+  size_t base = stmtStack.size();
 
-auto Parser::unary() -> std::expected<std::unique_ptr<Expr>, Error> {
-  if (match({Token::Type::BANG, Token::Type::MINUS})) {
-    auto op = previous();
-    auto right = unary();
-    if (!right)
-      return std::unexpected(right.error());
+  while (true) {
+    auto stmt = resumeDeclaration(bottom);
+    if (stmt)
+      return stmt;
+
+    size_t kept = stmtFrames.size();
+    while (kept > bottom && stmtFrames[kept - 1].kind != StmtFrame::Block)
+      kept--;
+    if (diagnostics && !isAtEnd() && kept > bottom) {
+      diagnostics->report(stmt.error());
+      if (!diagnostics->full()) {
+        if (kept < stmtFrames.size())
+          stmtStack.resize(stmtFrames[kept].base);
+        stmtFrames.resize(kept);
+        if (!check(Token::Type::RIGHT_BRACE))
+          synchronize();
+        continue;
+      }
+    }
 
-    return std::make_unique<Expr>(
-        std::move(Expr::Unary(std::move(op), std::move(*right))));
+    stmtFrames.resize(bottom);
+    stmtStack.resize(base);
+    synchronize();
+    return stmt;
   }
-
-  return call();
 }
 
-auto Parser::call() -> std::expected<std::unique_ptr<Expr>, Error> {
-  auto expr = primary();
-  if (!expr)
-    return std::unexpected(expr.error());
+// Statements are parsed on an explicit stack as well. Blocks, ifs, whiles
+// and functions push a frame and go on to parse their first child; every
+// finished statement is handed to the frame on top, which either asks for
+// the next child or is finished itself. Parsing starts with the next
+// statement for the frame on top, which is a block or nothing above bottom.
+auto Parser::resumeDeclaration(size_t bottom) -> std::expected<Stmt *, Error> {
+  // Declarations are only allowed at the top level and directly in blocks.
+  // break and return are not allowed at the top level itself; anywhere
+  // else, code generation checks that they are in a loop or function.
+  bool declaration = true;
 
   while (true) {
-    if (match({Token::Type::LEFT_PAREN})) {
-      expr = finishCall(std::move(*expr));
+    auto token = peek();
+    bool opens = token.type == Token::Type::IF ||
+                 token.type == Token::Type::WHILE ||
+                 token.type == Token::Type::LEFT_BRACE ||
+                 (declaration && token.type == Token::Type::FN);
+    std::optional<Stmt *> stmt;
+
+    if (opens) {
+      if (auto nested = nest(token); !nested)
+        return std::unexpected(nested.error());
+      advance();
+
+      StmtFrame frame{StmtFrame::Block, token};
+      if (token.type == Token::Type::FN) {
+        auto name = consume(Token::Type::IDENTIFIER);
+        if (!name)
+          return std::unexpected(name.error());
+
+        auto params = parameters();
+        if (!params)
+          return std::unexpected(params.error());
+
+        if (lazyBodies && stmtFrames.empty() &&
+            check(Token::Type::LEFT_BRACE)) {
+          auto function = skipBody(*name, *params);
+          if (!function)
+            return std::unexpected(function.error());
+          stmt = *function;
+        }
+        frame = {StmtFrame::Function, *name, nullptr, nullptr, *params};
+      } else if (token.type != Token::Type::LEFT_BRACE) {
+        auto cond = condition();
+        if (!cond)
+          return std::unexpected(cond.error());
+
+        auto kind = token.type == Token::Type::IF ? StmtFrame::If
+                                                  : StmtFrame::While;
+        frame = {kind, token, *cond};
+      }
+
+      if (!stmt) {
+        frame.base = stmtStack.size();
+        stmtFrames.push_back(frame);
+        declaration = false;
+        if (token.type != Token::Type::LEFT_BRACE)
+          continue;
+      }
+    } else if (stmtFrames.size() > bottom &&
+               stmtFrames.back().kind == StmtFrame::Block &&
+               (check(Token::Type::RIGHT_BRACE) || isAtEnd())) {
+      // Only after recovering in a block: it is closed below.
     } else {
-      break;
+      std::expected<Stmt *, Error> leaf = nullptr;
+      if (declaration && match({Token::Type::LET}))
+        leaf = varDeclaration();
+      else if (match({Token::Type::PRINT}))
+        leaf = printStatement();
+      else if (match({Token::Type::FOR}))
+        leaf = forStatement();
+      else if (stmtFrames.empty() && check(Token::Type::BREAK))
+        leaf = std::unexpected(Error{Error::BreakOutsideLoop, peek(), {}});
+      else if (stmtFrames.empty() && check(Token::Type::RETURN))
+        leaf = std::unexpected(
+            Error{Error::ReturnOutsideFunction, peek(), {}});
+      else if (match({Token::Type::BREAK}))
+        leaf = breakStatement();
+      else if (match({Token::Type::RETURN}))
+        leaf = returnStatement();
+      else
+        leaf = expressionStatement();
+
+      if (!leaf)
+        return std::unexpected(leaf.error());
+      stmt = *leaf;
     }
-  }
-
-  return expr;
-}
-
-auto Parser::finishCall(std::unique_ptr<Expr> callee)
-    -> std::expected<std::unique_ptr<Expr>, Error> {
-  std::vector<std::unique_ptr<Expr>> arguments;
 
-  if (!check(Token::Type::RIGHT_PAREN)) {
-    do {
-      if (arguments.size() >= 255)
-        return std::unexpected(Error{Error::TooManyArguments, peek(), {}});
-
-      auto expr = expression();
-      if (!expr)
-        return std::unexpected(expr.error());
-      arguments.push_back(std::move(*expr));
-    } while (match({Token::Type::COMMA}));
+    while (true) {
+      if (stmtFrames.size() == bottom)
+        return *stmt;
+
+      auto &frame = stmtFrames.back();
+      if (frame.kind == StmtFrame::Block) {
+        // A block that has just been opened has no statement to take yet.
+        if (stmt)
+          stmtStack.push_back(*stmt);
+        if (!check(Token::Type::RIGHT_BRACE) && !isAtEnd()) {
+          declaration = true;
+          break;
+        }
+
+        auto end = consume(Token::Type::RIGHT_BRACE);
+        if (!end)
+          return std::unexpected(end.error());
+
+        auto children = std::span<Stmt *const>(stmtStack).subspan(frame.base);
+        auto statements = context->copy(children);
+        stmtStack.resize(frame.base);
+        stmt = context->create<Stmt>(Stmt::Block(statements));
+      } else if (frame.kind == StmtFrame::If &&
+                 match({Token::Type::ELSE})) {
+        frame.kind = StmtFrame::Else;
+        frame.thenBranch = *stmt;
+        declaration = false;
+        break;
+      } else if (frame.kind == StmtFrame::If) {
+        stmt = context->create<Stmt>(Stmt::If(frame.condition, *stmt, nullptr));
+      } else if (frame.kind == StmtFrame::Else) {
+        stmt = context->create<Stmt>(
+            Stmt::If(frame.condition, frame.thenBranch, *stmt));
+      } else if (frame.kind == StmtFrame::While) {
+        stmt = context->create<Stmt>(Stmt::While(frame.condition, *stmt));
+      } else {
+        stmt = context->create<Stmt>(
+            Stmt::Function(frame.name, frame.params, *stmt));
+      }
+
+      stmtFrames.pop_back();
+    }
   }
-
-  auto paren = consume(Token::Type::RIGHT_PAREN);
-  if (!paren)
-    return std::unexpected(paren.error());
-
-  return std::make_unique<Expr>(std::move(
-      Expr::Call(std::move(callee), std::move(*paren), std::move(arguments))));
 }
 
-auto Parser::primary() -> std::expected<std::unique_ptr<Expr>, Error> {
-  if (match({Token::Type::FALSE}))
-    return std::make_unique<Expr>(std::move(Expr::Literal(previous())));
-  if (match({Token::Type::TRUE}))
-    return std::make_unique<Expr>(std::move(Expr::Literal(previous())));
-  //   if (match({Token::Type::NIL}))
-  //     return std::make_unique<Expr>(std::move(Expr::Literal(previous())));
-
-  if (match({Token::Type::NUMBER, Token::Type::STRING}))
-    return std::make_unique<Expr>(std::move(Expr::Literal(previous())));
-
-  if (match({Token::Type::IDENTIFIER}))
-    return std::make_unique<Expr>(std::move(Expr::Variable(previous())));
-
-  if (match({Token::Type::LEFT_PAREN})) {
-    auto expr = expression();
-    if (!expr)
-      return std::unexpected(expr.error());
-
-    auto paren = consume(Token::Type::RIGHT_PAREN);
-    if (!paren)
-      return std::unexpected(paren.error());
+// A body whose braces never balance runs to the end of the input, which an
+// eager parse would have taken as part of it. It is parsed after all from
+// its opening brace, by a parser of its own, so that the same errors are
+// reported; lexing errors were already reported on the way.
+auto Parser::skipBody(Token name, std::span<Token> params)
+    -> std::expected<Stmt *, Error> {
+  size_t index = current;
+  auto brace = advance();
+  for (size_t depth = 1; depth > 0;) {
+    if (isAtEnd()) {
+      Lexer rest(brace.file, brace.offset,
+                 SourceManager::instance().get(brace.file).text.size());
+      auto parser = lexer ? Parser(rest, *context, maxDepth)
+                          : Parser(view.subspan(index), end, *context,
+                                   maxDepth, false);
+      parser.diagnostics = diagnostics;
+      if (diagnostics)
+        parser.lexDiagnostics = Diagnostics(diagnostics->limit());
+      auto body = parser.declaration();
+      if (!body)
+        return std::unexpected(body.error());
+      return context->create<Stmt>(Stmt::Function(name, params, *body));
+    }
 
-    return std::make_unique<Expr>(std::move(Expr::Grouping(std::move(*expr))));
+    auto type = advance().type;
+    depth += type == Token::Type::LEFT_BRACE;
+    depth -= type == Token::Type::RIGHT_BRACE;
   }
 
-  return std::unexpected(
-      Error{Error::UnexpectedToken, peek(), {"primary expression"}});
+  auto close = previous();
+  auto *lazy = context->create<LazyBody>(brace, close.offset + close.length,
+                                         false, maxDepth, context, diagnostics);
+  return context->create<Stmt>(Stmt::Function(name, params, nullptr, lazy));
 }
 
-auto Parser::declaration() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  if (match({Token::Type::FN})) {
-    auto fn = function("function");
-    if (!fn)
-      synchronize();
-
-    return fn;
+auto Parser::body(const Stmt::Function &function) -> Stmt * {
+  auto *lazy = function.lazy;
+  if (function.body || !lazy || lazy->failed)
+    return function.body;
+
+  Lexer lexer(lazy->brace.file, lazy->brace.offset, lazy->end);
+  Parser parser(lexer, *lazy->context, lazy->maxDepth);
+  // Errors are recovered from as in an eager parse. The rest of the file was
+  // parsed first, so they are collected apart and merged, which keeps the
+  // first errors in source order once the limit is reached.
+  Diagnostics errors(lazy->diagnostics ? lazy->diagnostics->limit() : 0);
+  if (lazy->diagnostics) {
+    parser.diagnostics = &errors;
+    parser.lexDiagnostics = Diagnostics(errors.limit());
   }
-
-  if (match({Token::Type::LET})) {
-    auto var = varDeclaration();
-    if (!var)
-      synchronize();
-
-    return var;
+  auto body = parser.declaration();
+  // Lexing errors were already reported when the body was skipped.
+  if (!body && body.error().token.type != Token::Type::ERROR)
+    errors.report(body.error());
+  if (lazy->diagnostics)
+    lazy->diagnostics->merge(std::move(errors));
+  if (!body) {
+    lazy->failed = true;
+    return nullptr;
   }
 
-  if (match({Token::Type::FOR})) {
-    auto forStmt = forStatement();
-    if (!forStmt)
-      synchronize();
-
-    return forStmt;
-  }
+  function.body = *body;
+  return function.body;
+}
 
-  if (match({Token::Type::IF})) {
-    auto ifStmt = ifStatement();
-    if (!ifStmt)
-      synchronize();
+auto Parser::condition() -> std::expected<Expr *, Error> {
+  auto begin = consume(Token::Type::LEFT_PAREN);
+  if (!begin)
+    return std::unexpected(begin.error());
 
-    return ifStmt;
-  }
+  auto condition = expression();
+  if (!condition)
+    return std::unexpected(condition.error());
 
-  if (match({Token::Type::WHILE})) {
-    auto whileStmt = whileStatement();
-    if (!whileStmt)
-      synchronize();
+  auto end = consume(Token::Type::RIGHT_PAREN);
+  if (!end)
+    return std::unexpected(end.error());
 
-    return whileStmt;
-  }
+  return condition;
+}
 
-  if (match({Token::Type::PRINT})) {
-    auto printStmt = printStatement();
-    if (!printStmt)
-      synchronize();
+auto Parser::parameters() -> std::expected<std::span<Token>, Error> {
+  auto begin = consume(Token::Type::LEFT_PAREN);
+  if (!begin)
+    return std::unexpected(begin.error());
 
-    return printStmt;
-  }
+  paramStack.clear();
+  if (!check(Token::Type::RIGHT_PAREN)) {
+    do {
+      if (paramStack.size() >= 255)
+        return std::unexpected(Error{Error::TooManyParameters, previous(), {}});
 
-  if (match({Token::Type::LEFT_BRACE})) {
-    auto blockStmt = block();
-    if (!blockStmt)
-      synchronize();
+      auto param = consume(Token::Type::IDENTIFIER);
+      if (!param)
+        return std::unexpected(param.error());
 
-    return blockStmt;
+      paramStack.push_back(*param);
+    } while (match({Token::Type::COMMA}));
   }
 
-  auto exprStmt = expressionStatement();
-  if (!exprStmt)
-    synchronize();
+  auto end = consume(Token::Type::RIGHT_PAREN);
+  if (!end)
+    return std::unexpected(end.error());
 
-  return exprStmt;
+  return context->copy(std::span<const Token>(paramStack));
 }
 
-auto Parser::varDeclaration() -> std::expected<std::unique_ptr<Stmt>, Error> {
+auto Parser::varDeclaration() -> std::expected<Stmt *, Error> {
   auto name = consume(Token::Type::IDENTIFIER);
   if (!name)
     return std::unexpected(name.error());
 
-  std::unique_ptr<Expr> initializer = nullptr;
+  Expr *initializer = nullptr;
 
   if (match({Token::Type::EQUAL})) {
     auto expr = expression();
     if (!expr)
       return std::unexpected(expr.error());
 
-    initializer = std::move(*expr);
+    initializer = *expr;
   }
 
   auto end = consume(Token::Type::SEMICOLON);
   if (!end)
     return std::unexpected(end.error());
 
-  return std::make_unique<Stmt>(
-      std::move(Stmt::Var(std::move(*name), std::move(initializer))));
+  return context->create<Stmt>(Stmt::Var(std::move(*name), initializer));
 }
 
-auto Parser::statement() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  if (match({Token::Type::PRINT}))
-    return printStatement();
-  if (match({Token::Type::LEFT_BRACE}))
-    return block();
-  if (match({Token::Type::IF}))
-    return ifStatement();
-  if (match({Token::Type::WHILE}))
-    return whileStatement();
-  if (match({Token::Type::FOR}))
-    return forStatement();
-  if (match({Token::Type::BREAK}))
-    return breakStatement();
-  if (match({Token::Type::RETURN}))
-    return returnStatement();
-
-  return expressionStatement();
-}
 
-auto Parser::printStatement() -> std::expected<std::unique_ptr<Stmt>, Error> {
+auto Parser::printStatement() -> std::expected<Stmt *, Error> {
   auto value = expression();
   if (!value)
     return std::unexpected(value.error());
@@ -459,11 +804,11 @@ auto Parser::printStatement() -> std::expected<std::unique_ptr<Stmt>, Error> {
   if (!end)
     return std::unexpected(end.error());
 
-  return std::make_unique<Stmt>(std::move(Stmt::Print(std::move(*value))));
+  return context->create<Stmt>(Stmt::Print(*value));
 }
 
-auto Parser::expressionStatement()
-    -> std::expected<std::unique_ptr<Stmt>, Error> {
+
+auto Parser::expressionStatement() -> std::expected<Stmt *, Error> {
   auto expr = expression();
   if (!expr)
     return std::unexpected(expr.error());
@@ -472,123 +817,39 @@ auto Parser::expressionStatement()
   if (!end)
     return std::unexpected(end.error());
 
-  return std::make_unique<Stmt>(std::move(Stmt::Expression(std::move(*expr))));
+  return context->create<Stmt>(Stmt::Expression(*expr));
 }
 
-auto Parser::block() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  std::vector<std::unique_ptr<Stmt>> statements;
 
-  while (!check(Token::Type::RIGHT_BRACE) && !isAtEnd()) {
-    auto decl = declaration();
-    if (!decl)
-      return std::unexpected(decl.error());
-
-    statements.push_back(std::move(*decl));
-  }
-
-  auto end = consume(Token::Type::RIGHT_BRACE);
-  if (!end)
-    return std::unexpected(end.error());
-
-  return std::make_unique<Stmt>(std::move(Stmt::Block(std::move(statements))));
-}
-
-auto Parser::ifStatement() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  auto begin = consume(Token::Type::LEFT_PAREN);
-  if (!begin)
-    return std::unexpected(begin.error());
-
-  auto condition = expression();
-  if (!condition)
-    return std::unexpected(condition.error());
-
-  auto end = consume(Token::Type::RIGHT_PAREN);
-  if (!end)
-    return std::unexpected(end.error());
-
-  auto thenBranch = statement();
-  if (!thenBranch)
-    return std::unexpected(thenBranch.error());
-
-  std::unique_ptr<Stmt> elseBranch = nullptr;
-
-  if (match({Token::Type::ELSE})) {
-    auto stmt = statement();
-    if (!stmt)
-      return std::unexpected(stmt.error());
-
-    elseBranch = std::move(*stmt);
-  }
-
-  return std::make_unique<Stmt>(std::move(Stmt::If(
-      std::move(*condition), std::move(*thenBranch), std::move(elseBranch))));
+auto Parser::forStatement() -> std::expected<Stmt *, Error> {
+  return nullptr;
 }
 
-auto Parser::whileStatement() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  auto begin = consume(Token::Type::LEFT_PAREN);
-  if (!begin)
-    return std::unexpected(begin.error());
+auto Parser::breakStatement() -> std::expected<Stmt *, Error> {
+  auto keyword = previous();
 
-  auto condition = expression();
-  if (!condition)
-    return std::unexpected(condition.error());
-
-  auto end = consume(Token::Type::RIGHT_PAREN);
+  auto end = consume(Token::Type::SEMICOLON);
   if (!end)
     return std::unexpected(end.error());
 
-  auto body = statement();
-  if (!body)
-    return std::unexpected(body.error());
-
-  return std::make_unique<Stmt>(
-      std::move(Stmt::While(std::move(*condition), std::move(*body))));
+  return context->create<Stmt>(Stmt::Break(keyword));
 }
 
-auto Parser::forStatement() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  return nullptr;
-}
+auto Parser::returnStatement() -> std::expected<Stmt *, Error> {
+  auto keyword = previous();
 
-auto Parser::breakStatement() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  return nullptr;
-}
-
-auto Parser::function(std::string kind)
-    -> std::expected<std::unique_ptr<Stmt>, Error> {
-  auto name = consume(Token::Type::IDENTIFIER);
-  if (!name)
-    return std::unexpected(name.error());
-
-  auto begin = consume(Token::Type::LEFT_PAREN);
-  if (!begin)
-    return std::unexpected(begin.error());
-
-  std::vector<Token> params;
-  if (!check(Token::Type::RIGHT_PAREN)) {
-    do {
-      if (params.size() >= 255)
-        return std::unexpected(Error{Error::TooManyParameters, previous(), {}});
-
-      auto param = consume(Token::Type::IDENTIFIER);
-      if (!param)
-        return std::unexpected(param.error());
+  Expr *value = nullptr;
+  if (!check(Token::Type::SEMICOLON)) {
+    auto expr = expression();
+    if (!expr)
+      return std::unexpected(expr.error());
 
-      params.push_back(std::move(*param));
-    } while (match({Token::Type::COMMA}));
+    value = *expr;
   }
 
-  auto end = consume(Token::Type::RIGHT_PAREN);
+  auto end = consume(Token::Type::SEMICOLON);
   if (!end)
     return std::unexpected(end.error());
 
-  auto body = statement();
-  if (!body)
-    return std::unexpected(body.error());
-
-  return std::make_unique<Stmt>(std::move(
-      Stmt::Function(std::move(*name), std::move(params), std::move(*body))));
-}
-
-auto Parser::returnStatement() -> std::expected<std::unique_ptr<Stmt>, Error> {
-  return nullptr;
+  return context->create<Stmt>(Stmt::Return(keyword, value));
 }
\ No newline at end of file
@@ -1,121 +1,470 @@
+#include <parser.hpp>
 #include <printer.hpp>
 
-#include <format>
-#include <iostream>
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <type_traits>
 
-auto Printer::print(std::vector<std::unique_ptr<Stmt>> statements) -> void {
-  for (const auto &stmt : statements) {
-    stmt->accept(
-        [this](const auto &s) { std::cout << to_string(s) << std::endl; });
+auto Printer::parse(std::string_view name) -> std::optional<Format> {
+  if (name == "sexpr")
+    return Format::SExpr;
+  if (name == "json")
+    return Format::Json;
+  if (name == "tree")
+    return Format::Tree;
+  return std::nullopt;
+}
+
+auto Printer::print(std::span<Stmt *const> statements, std::ostream &stream)
+    -> void {
+  Output output(stream);
+  out = &output;
+  open();
+  bool first = true;
+  for (const auto *stmt : statements) {
+    before(first);
+    write(child(nullptr, stmt));
+    after();
+    first = false;
+  }
+  close();
+  out = nullptr;
+}
+
+auto Printer::print(const FlatAST &ast, std::ostream &stream) -> void {
+  Output output(stream);
+  out = &output;
+  open();
+  bool first = true;
+  for (auto root : ast.roots) {
+    before(first);
+    write(ast, root);
+    after();
+    first = false;
   }
+  close();
+  out = nullptr;
 }
 
 auto Printer::to_string(const Expr &expr) -> std::string {
-  return expr.accept([this](const auto &e) { return to_string(e); });
+  Output output;
+  out = &output;
+  write(child(nullptr, &expr));
+  out = nullptr;
+  return output.text();
 }
 
 auto Printer::to_string(const Stmt &stmt) -> std::string {
-  return stmt.accept([this](const auto &s) { return to_string(s); });
+  Output output;
+  out = &output;
+  write(child(nullptr, &stmt));
+  out = nullptr;
+  return output.text();
 }
 
-auto Printer::to_string(const Expr::Assign &expr) -> std::string {
-  return std::format("(assign {} {})", expr.name.lexeme,
-                     to_string(*expr.value));
+auto Printer::to_string(const FlatAST &ast, NodeId node) -> std::string {
+  Output output;
+  out = &output;
+  write(ast, node);
+  out = nullptr;
+  return output.text();
 }
 
-auto Printer::to_string(const Expr::Binary &expr) -> std::string {
-  return std::format("(binary {} {} {})", expr.op.lexeme, to_string(*expr.left),
-                     to_string(*expr.right));
+auto Printer::write(Piece root) -> void {
+  pieces.push_back(root);
+
+  while (!pieces.empty()) {
+    auto piece = pieces.back();
+    pieces.pop_back();
+
+    std::visit(
+        [this]<class T>(const T &p) {
+          if constexpr (std::is_same_v<T, Child<const Expr *>> ||
+                        std::is_same_v<T, Child<const Stmt *>>) {
+            key(p.label);
+            if (p.node)
+              p.node->accept([this](const auto &node) { expand(node); });
+            else
+              missing();
+          } else {
+            render(p);
+          }
+        },
+        piece);
+  }
 }
 
-auto Printer::to_string(const Expr::Call &expr) -> std::string {
-  std::string args;
-  for (const auto &arg : expr.arguments)
-    args += to_string(*arg) + " ";
+auto Printer::write(const FlatAST &ast, NodeId root) -> void {
+  flatPieces.push_back(child(nullptr, root));
 
-  return std::format("(call {} {} {})", to_string(*expr.callee),
-                     expr.paren.lexeme, args);
+  while (!flatPieces.empty()) {
+    auto piece = flatPieces.back();
+    flatPieces.pop_back();
+
+    std::visit(
+        [&]<class T>(const T &p) {
+          if constexpr (std::is_same_v<T, Child<NodeId>>) {
+            key(p.label);
+            if (p.node != FlatAST::none)
+              expand(ast, p.node);
+            else
+              missing();
+          } else {
+            render(p);
+          }
+        },
+        piece);
+  }
 }
 
-auto Printer::to_string(const Expr::Get &expr) -> std::string {
-  return std::format("(get {} {})", to_string(*expr.object), expr.name.lexeme);
+auto Printer::open() -> void {
+  if (format == Format::Json)
+    out->write("{\"statements\": [");
 }
 
-auto Printer::to_string(const Expr::Grouping &expr) -> std::string {
-  return std::format("(grouping {})", to_string(*expr.expression));
+auto Printer::before(bool first) -> void {
+  if (format == Format::Json)
+    out->write(first ? "\n  " : ",\n  ");
 }
 
-auto Printer::to_string(const Expr::Literal &expr) -> std::string {
-  return std::format("(literal {})", expr.value.lexeme);
+auto Printer::after() -> void {
+  if (format != Format::Json)
+    out->write('\n');
 }
 
-auto Printer::to_string(const Expr::Logical &expr) -> std::string {
-  return std::format("(logical {} {} {})", expr.op.lexeme,
-                     to_string(*expr.left), to_string(*expr.right));
+auto Printer::close() -> void {
+  if (format == Format::Json)
+    out->write("\n]}\n");
 }
 
-auto Printer::to_string(const Expr::Set &expr) -> std::string {
-  return std::format("(set {} {} {})", to_string(*expr.object),
-                     expr.name.lexeme, to_string(*expr.value));
+auto Printer::render(const Begin &piece) -> void {
+  switch (format) {
+  case Format::SExpr:
+    out->write('(');
+    out->write(piece.kind);
+    break;
+  case Format::Json:
+    out->write("{\"kind\": \"");
+    out->write(piece.kind);
+    out->write('"');
+    break;
+  case Format::Tree:
+    if (depth > 0)
+      indent();
+    out->write(piece.kind);
+    break;
+  }
+  depth++;
+  lineOpen = true;
 }
 
-auto Printer::to_string(const Expr::This &expr) -> std::string {
-  return std::format("(this {})", expr.keyword.lexeme);
+// In a tree, a token that follows one of the node's children goes on a line
+// of its own, labelled, since the node's line has already ended.
+auto Printer::render(const Field &piece) -> void {
+  if (format == Format::Json) {
+    out->write(", \"");
+    out->write(piece.label);
+    out->write("\": ");
+    out->escaped(piece.text);
+  } else if (format == Format::Tree && !lineOpen) {
+    indent();
+    out->write(piece.label);
+    out->write(": ");
+    out->write(piece.text);
+  } else {
+    out->write(' ');
+    out->write(piece.text);
+  }
 }
 
-auto Printer::to_string(const Expr::Unary &expr) -> std::string {
-  return std::format("(unary {} {})", expr.op.lexeme, to_string(*expr.right));
+auto Printer::render(const List &piece) -> void {
+  if (format == Format::Json) {
+    out->write(", \"");
+    out->write(piece.label);
+    out->write("\": [");
+  } else if (piece.words) {
+    out->write(" (");
+  } else if (format == Format::SExpr) {
+    out->write(' ');
+  }
 }
 
-auto Printer::to_string(const Expr::Variable &expr) -> std::string {
-  return std::format("(variable {})", expr.name.lexeme);
+auto Printer::render(const Word &piece) -> void {
+  if (format == Format::Json) {
+    out->escaped(piece.text);
+    if (!piece.last)
+      out->write(", ");
+  } else {
+    out->write(piece.text);
+    if (format == Format::SExpr || !piece.last)
+      out->write(' ');
+  }
 }
 
-auto Printer::to_string(const Stmt::Block &stmt) -> std::string {
-  std::string statements;
-  for (const auto &statement : stmt.statements)
-    statements += to_string(*statement) + " ";
+auto Printer::render(const Item &piece) -> void {
+  if (format == Format::SExpr)
+    out->write(' ');
+  else if (format == Format::Json && !piece.last)
+    out->write(", ");
+}
 
-  return std::format("(block {})", statements);
+auto Printer::render(const EndList &piece) -> void {
+  if (format == Format::Json)
+    out->write(']');
+  else if (piece.words)
+    out->write(')');
 }
 
-auto Printer::to_string(const Stmt::Break &stmt) -> std::string {
-  return std::format("(break {})", stmt.keyword.lexeme);
+auto Printer::render(const End &) -> void {
+  depth--;
+  lineOpen = false;
+  if (format == Format::SExpr)
+    out->write(')');
+  else if (format == Format::Json)
+    out->write('}');
 }
 
-auto Printer::to_string(const Stmt::Expression &stmt) -> std::string {
-  return std::format("(expression {})", to_string(*stmt.expression));
+auto Printer::key(const char *label) -> void {
+  if (!label)
+    return;
+  if (format == Format::SExpr) {
+    out->write(' ');
+  } else if (format == Format::Json) {
+    out->write(", \"");
+    out->write(label);
+    out->write("\": ");
+  }
 }
 
-auto Printer::to_string(const Stmt::Function &stmt) -> std::string {
-  std::string params;
-  for (const auto &param : stmt.params)
-    params += param.lexeme + " ";
+auto Printer::missing() -> void {
+  if (format == Format::Json)
+    out->write("null");
+}
+
+auto Printer::indent() -> void {
+  out->write('\n');
+  out->spaces(2 * std::min(depth, maxIndent));
+  if (depth > maxIndent) {
+    char buffer[24];
+    auto [end, error] = std::to_chars(buffer, buffer + sizeof buffer, depth);
+    out->write({buffer, end});
+    out->write(": ");
+  }
+}
+
+auto Printer::push(std::initializer_list<Piece> list) -> void {
+  for (auto piece = list.end(); piece != list.begin();)
+    pieces.push_back(*--piece);
+}
+
+auto Printer::pushFlat(std::initializer_list<FlatPiece> list) -> void {
+  for (auto piece = list.end(); piece != list.begin();)
+    flatPieces.push_back(*--piece);
+}
 
-  return std::format("(function {} ({}) {})", stmt.name.lexeme, params,
-                     to_string(*stmt.body));
+// Nothing is left to come before the pieces ahead of a node's first child, so
+// they are rendered at once, with no trip through the stack, and only the
+// rest are scheduled.
+template <class P, class... Parts>
+auto Printer::emit(std::vector<P> &stack, const Parts &...parts) -> void {
+  std::array<P, sizeof...(Parts)> rest;
+  size_t count = 0;
+  (
+      [&] {
+        if constexpr (requires { parts.node; })
+          rest[count++] = parts;
+        else if (count > 0)
+          rest[count++] = parts;
+        else
+          render(parts);
+      }(),
+      ...);
+  while (count > 0)
+    stack.push_back(rest[--count]);
 }
 
-auto Printer::to_string(const Stmt::If &stmt) -> std::string {
-  return std::format("(if {} {} {})", to_string(*stmt.condition),
-                     to_string(*stmt.thenBranch), to_string(*stmt.elseBranch));
+auto Printer::expand(const Expr::Assign &expr) -> void {
+  emit(pieces, Begin{"assign"}, Field{"name", expr.name.lexeme()},
+       child("value", expr.value), End{});
 }
 
-auto Printer::to_string(const Stmt::Print &stmt) -> std::string {
-  return std::format("(print {})", to_string(*stmt.expression));
+auto Printer::expand(const Expr::Binary &expr) -> void {
+  emit(pieces, Begin{"binary"}, Field{"op", expr.op.lexeme()},
+       child("left", expr.left), child("right", expr.right), End{});
 }
 
-auto Printer::to_string(const Stmt::Return &stmt) -> std::string {
-  return std::format("(return {} {})", stmt.keyword.lexeme,
-                     to_string(*stmt.value));
+auto Printer::expand(const Expr::Call &expr) -> void {
+  push({EndList{false}, End{}});
+  for (auto arg = expr.arguments.rbegin(); arg != expr.arguments.rend(); arg++)
+    push({child(nullptr, *arg), Item{arg == expr.arguments.rbegin()}});
+  emit(pieces, Begin{"call"}, child("callee", expr.callee),
+       Field{"paren", expr.paren.lexeme()}, List{"arguments", false});
 }
 
-auto Printer::to_string(const Stmt::Var &stmt) -> std::string {
-  return std::format("(var {} {})", stmt.name.lexeme,
-                     to_string(*stmt.initializer));
+auto Printer::expand(const Expr::Get &expr) -> void {
+  emit(pieces, Begin{"get"}, child("object", expr.object),
+       Field{"name", expr.name.lexeme()}, End{});
 }
 
-auto Printer::to_string(const Stmt::While &stmt) -> std::string {
-  return std::format("(while {} {})", to_string(*stmt.condition),
-                     to_string(*stmt.body));
+auto Printer::expand(const Expr::Grouping &expr) -> void {
+  emit(pieces, Begin{"grouping"}, child("expression", expr.expression),
+       End{});
+}
+
+auto Printer::expand(const Expr::Literal &expr) -> void {
+  emit(pieces, Begin{"literal"}, Field{"value", expr.value.lexeme()}, End{});
+}
+
+auto Printer::expand(const Expr::Logical &expr) -> void {
+  emit(pieces, Begin{"logical"}, Field{"op", expr.op.lexeme()},
+       child("left", expr.left), child("right", expr.right), End{});
+}
+
+auto Printer::expand(const Expr::Set &expr) -> void {
+  emit(pieces, Begin{"set"}, child("object", expr.object),
+       Field{"name", expr.name.lexeme()}, child("value", expr.value), End{});
+}
+
+auto Printer::expand(const Expr::This &expr) -> void {
+  emit(pieces, Begin{"this"}, Field{"keyword", expr.keyword.lexeme()},
+       End{});
+}
+
+auto Printer::expand(const Expr::Unary &expr) -> void {
+  emit(pieces, Begin{"unary"}, Field{"op", expr.op.lexeme()},
+       child("right", expr.right), End{});
+}
+
+auto Printer::expand(const Expr::Variable &expr) -> void {
+  emit(pieces, Begin{"variable"}, Field{"name", expr.name.lexeme()}, End{});
+}
+
+auto Printer::expand(const Stmt::Block &stmt) -> void {
+  push({EndList{false}, End{}});
+  for (auto statement = stmt.statements.rbegin();
+       statement != stmt.statements.rend(); statement++)
+    push({child(nullptr, *statement),
+          Item{statement == stmt.statements.rbegin()}});
+  emit(pieces, Begin{"block"}, List{"statements", false});
+}
+
+auto Printer::expand(const Stmt::Break &stmt) -> void {
+  emit(pieces, Begin{"break"}, Field{"keyword", stmt.keyword.lexeme()},
+       End{});
+}
+
+auto Printer::expand(const Stmt::Expression &stmt) -> void {
+  emit(pieces, Begin{"expression"}, child("expression", stmt.expression),
+       End{});
+}
+
+auto Printer::expand(const Stmt::Function &stmt) -> void {
+  push({EndList{true}, child("body", Parser::body(stmt)), End{}});
+  for (auto param = stmt.params.rbegin(); param != stmt.params.rend(); param++)
+    push({Word{param->lexeme(), param == stmt.params.rbegin()}});
+  emit(pieces, Begin{"function"}, Field{"name", stmt.name.lexeme()},
+       List{"params", true});
+}
+
+auto Printer::expand(const Stmt::If &stmt) -> void {
+  emit(pieces, Begin{"if"}, child("condition", stmt.condition),
+       child("then", stmt.thenBranch), child("else", stmt.elseBranch), End{});
+}
+
+auto Printer::expand(const Stmt::Print &stmt) -> void {
+  emit(pieces, Begin{"print"}, child("expression", stmt.expression), End{});
+}
+
+auto Printer::expand(const Stmt::Return &stmt) -> void {
+  emit(pieces, Begin{"return"}, Field{"keyword", stmt.keyword.lexeme()},
+       child("value", stmt.value), End{});
+}
+
+auto Printer::expand(const Stmt::Var &stmt) -> void {
+  emit(pieces, Begin{"var"}, Field{"name", stmt.name.lexeme()},
+       child("initializer", stmt.initializer), End{});
+}
+
+auto Printer::expand(const Stmt::While &stmt) -> void {
+  emit(pieces, Begin{"while"}, child("condition", stmt.condition),
+       child("body", stmt.body), End{});
+}
+
+auto Printer::expand(const FlatAST &ast, NodeId node) -> void {
+  auto lexeme = [&] { return ast.token(node).lexeme(); };
+  auto lhs = ast.lhs[node];
+  auto rhs = ast.rhs[node];
+  auto &stack = flatPieces;
+
+  switch (ast.kind(node)) {
+  case FlatAST::Kind::Assign:
+    return emit(stack, Begin{"assign"}, Field{"name", lexeme()},
+                child("value", lhs), End{});
+  case FlatAST::Kind::Binary:
+    return emit(stack, Begin{"binary"}, Field{"op", lexeme()},
+                child("left", lhs), child("right", rhs), End{});
+  case FlatAST::Kind::Call: {
+    auto args = ast.list(node);
+    pushFlat({EndList{false}, End{}});
+    for (auto arg = args.rbegin(); arg != args.rend(); arg++)
+      pushFlat({child(nullptr, *arg), Item{arg == args.rbegin()}});
+    return emit(stack, Begin{"call"}, child("callee", lhs),
+                Field{"paren", lexeme()}, List{"arguments", false});
+  }
+  case FlatAST::Kind::Get:
+    return emit(stack, Begin{"get"}, child("object", lhs),
+                Field{"name", lexeme()}, End{});
+  case FlatAST::Kind::Grouping:
+    return emit(stack, Begin{"grouping"}, child("expression", lhs), End{});
+  case FlatAST::Kind::Literal:
+    return emit(stack, Begin{"literal"}, Field{"value", lexeme()}, End{});
+  case FlatAST::Kind::Logical:
+    return emit(stack, Begin{"logical"}, Field{"op", lexeme()},
+                child("left", lhs), child("right", rhs), End{});
+  case FlatAST::Kind::Set:
+    return emit(stack, Begin{"set"}, child("object", lhs),
+                Field{"name", lexeme()}, child("value", rhs), End{});
+  case FlatAST::Kind::This:
+    return emit(stack, Begin{"this"}, Field{"keyword", lexeme()}, End{});
+  case FlatAST::Kind::Unary:
+    return emit(stack, Begin{"unary"}, Field{"op", lexeme()},
+                child("right", lhs), End{});
+  case FlatAST::Kind::Variable:
+    return emit(stack, Begin{"variable"}, Field{"name", lexeme()}, End{});
+  case FlatAST::Kind::Block: {
+    auto statements = ast.list(node);
+    pushFlat({EndList{false}, End{}});
+    for (auto stmt = statements.rbegin(); stmt != statements.rend(); stmt++)
+      pushFlat({child(nullptr, *stmt), Item{stmt == statements.rbegin()}});
+    return emit(stack, Begin{"block"}, List{"statements", false});
+  }
+  case FlatAST::Kind::Break:
+    return emit(stack, Begin{"break"}, Field{"keyword", lexeme()}, End{});
+  case FlatAST::Kind::Expression:
+    return emit(stack, Begin{"expression"}, child("expression", lhs), End{});
+  case FlatAST::Kind::Function: {
+    auto params = ast.params(node);
+    pushFlat({EndList{true}, child("body", rhs), End{}});
+    for (auto param = params.rbegin(); param != params.rend(); param++)
+      pushFlat({Word{ast.tokens[*param].lexeme(), param == params.rbegin()}});
+    return emit(stack, Begin{"function"}, Field{"name", lexeme()},
+                List{"params", true});
+  }
+  case FlatAST::Kind::If:
+    return emit(stack, Begin{"if"}, child("condition", lhs),
+                child("then", ast.extra[rhs]),
+                child("else", ast.extra[rhs + 1]), End{});
+  case FlatAST::Kind::Print:
+    return emit(stack, Begin{"print"}, child("expression", lhs), End{});
+  case FlatAST::Kind::Return:
+    return emit(stack, Begin{"return"}, Field{"keyword", lexeme()},
+                child("value", lhs), End{});
+  case FlatAST::Kind::Var:
+    return emit(stack, Begin{"var"}, Field{"name", lexeme()},
+                child("initializer", lhs), End{});
+  case FlatAST::Kind::While:
+    return emit(stack, Begin{"while"}, child("condition", lhs),
+                child("body", rhs), End{});
+  }
 }
@@ -0,0 +1,258 @@
+#include <interner.hpp>
+#include <parser.hpp>
+#include <resolver.hpp>
+
+#include <initializer_list>
+#include <limits>
+#include <variant>
+#include <vector>
+
+namespace {
+
+// Walks the program in source order without recursion. Declarations are
+// tracked on a stack of locals, and for each name the innermost local that
+// declares it is kept in a table indexed by symbol; closing a scope pops its
+// locals and restores the ones they shadowed.
+struct Resolver {
+  static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+  struct Local {
+    Symbol name;
+    uint32_t scope;
+    uint32_t previous;
+    bool defined;
+  };
+
+  struct Scope {
+    const Stmt *owner;
+    uint32_t base;
+    bool function;
+  };
+
+  struct Global {
+    uint32_t index = none;
+    bool defined = false;
+  };
+
+  // Runs once the initializer of a variable has been resolved.
+  struct Define {
+    Symbol name;
+  };
+
+  // Runs once the contents of a scope have been resolved.
+  struct Close {};
+
+  using Task = std::variant<const Expr *, const Stmt *, Define, Close>;
+
+  Diagnostics &diagnostics;
+  Resolution resolution;
+  std::vector<Task> tasks;
+  std::vector<Local> locals;
+  std::vector<uint32_t> innermost;
+  std::vector<Scope> scopes;
+  std::vector<Global> globals;
+  size_t functions = 0;
+
+  auto resolve(std::span<Stmt *const> statements) -> Resolution {
+    // Every top-level name gets its index up front, so that functions can
+    // use the ones declared after them.
+    for (const auto *stmt : statements) {
+      if (!stmt)
+        continue;
+      if (const auto *var = std::get_if<Stmt::Var>(&stmt->stmt))
+        declareGlobal(var->name.symbol);
+      else if (const auto *function = std::get_if<Stmt::Function>(&stmt->stmt))
+        declareGlobal(function->name.symbol).defined = true;
+    }
+
+    push(std::span(statements.data(), statements.size()));
+    while (!tasks.empty() && !diagnostics.full()) {
+      auto task = tasks.back();
+      tasks.pop_back();
+      std::visit([this](auto task) { run(task); }, task);
+    }
+    return std::move(resolution);
+  }
+
+  auto push(std::initializer_list<Task> list) -> void {
+    for (auto task = list.end(); task != list.begin();)
+      tasks.push_back(*--task);
+  }
+
+  template <class T> auto push(std::span<T *const> list) -> void {
+    for (auto node = list.rbegin(); node != list.rend(); ++node)
+      tasks.push_back(static_cast<const T *>(*node));
+  }
+
+  template <class T> auto push(std::span<T *> list) -> void {
+    push(std::span<T *const>(list));
+  }
+
+  auto global(Symbol name) -> Global & {
+    if (name >= globals.size())
+      globals.resize(name + 1);
+    return globals[name];
+  }
+
+  auto declareGlobal(Symbol name) -> Global & {
+    auto &entry = global(name);
+    if (entry.index == none)
+      entry.index = resolution.globals++;
+    return entry;
+  }
+
+  auto local(Symbol name) -> uint32_t & {
+    if (name >= innermost.size())
+      innermost.resize(name + 1, none);
+    return innermost[name];
+  }
+
+  // Declares name in the innermost scope, or as a global outside any scope.
+  auto declare(const Stmt *stmt, Symbol name, bool defined) -> void {
+    if (scopes.empty()) {
+      resolution.declarations[stmt] = {Binding::Kind::Global, 0,
+                                       global(name).index};
+      return;
+    }
+    auto &slot = local(name);
+    uint32_t index = locals.size() - scopes.back().base;
+    locals.push_back({name, uint32_t(scopes.size() - 1), slot, defined});
+    slot = locals.size() - 1;
+    if (stmt)
+      resolution.declarations[stmt] = {Binding::Kind::Local, 0, index};
+  }
+
+  auto bind(const Expr *expr, const Token &name) -> void {
+    if (auto slot = local(name.symbol); slot != none) {
+      const auto &entry = locals[slot];
+      if (!entry.defined)
+        report(Error::UseBeforeDefinition, name);
+      resolution.uses[expr] = {Binding::Kind::Local,
+                               uint32_t(scopes.size() - 1 - entry.scope),
+                               slot - scopes[entry.scope].base};
+    } else if (const auto &entry = global(name.symbol); entry.index != none) {
+      if (!functions && !entry.defined)
+        report(Error::UseBeforeDefinition, name);
+      resolution.uses[expr] = {Binding::Kind::Global, 0, entry.index};
+    } else {
+      report(Error::UndefinedVariable, name);
+    }
+  }
+
+  auto report(Error::Type type, const Token &token) -> void {
+    diagnostics.report(Error{type, token, {}});
+  }
+
+  auto open(const Stmt *owner, bool function) -> void {
+    scopes.push_back({owner, uint32_t(locals.size()), function});
+    functions += function;
+  }
+
+  auto run(const Expr *expr) -> void {
+    if (expr)
+      expr->accept([&](const auto &node) { visit(expr, node); });
+  }
+
+  auto run(const Stmt *stmt) -> void {
+    if (stmt)
+      stmt->accept([&](const auto &node) { visit(stmt, node); });
+  }
+
+  auto run(Define define) -> void {
+    if (scopes.empty())
+      global(define.name).defined = true;
+    else
+      locals[local(define.name)].defined = true;
+  }
+
+  auto run(Close) -> void {
+    auto scope = scopes.back();
+    scopes.pop_back();
+    functions -= scope.function;
+    resolution.slots[scope.owner] = locals.size() - scope.base;
+    while (locals.size() > scope.base) {
+      innermost[locals.back().name] = locals.back().previous;
+      locals.pop_back();
+    }
+  }
+
+  auto visit(const Expr *expr, const Expr::Assign &node) -> void {
+    bind(expr, node.name);
+    push({node.value});
+  }
+  auto visit(const Expr *, const Expr::Binary &node) -> void {
+    push({node.left, node.right});
+  }
+  auto visit(const Expr *, const Expr::Call &node) -> void {
+    push(node.arguments);
+    push({node.callee});
+  }
+  auto visit(const Expr *, const Expr::Get &node) -> void {
+    push({node.object});
+  }
+  auto visit(const Expr *, const Expr::Grouping &node) -> void {
+    push({node.expression});
+  }
+  auto visit(const Expr *, const Expr::Literal &) -> void {}
+  auto visit(const Expr *, const Expr::Logical &node) -> void {
+    push({node.left, node.right});
+  }
+  auto visit(const Expr *, const Expr::Set &node) -> void {
+    push({node.object, node.value});
+  }
+  auto visit(const Expr *, const Expr::This &) -> void {}
+  auto visit(const Expr *, const Expr::Unary &node) -> void {
+    push({node.right});
+  }
+  auto visit(const Expr *expr, const Expr::Variable &node) -> void {
+    bind(expr, node.name);
+  }
+
+  auto visit(const Stmt *stmt, const Stmt::Block &node) -> void {
+    open(stmt, false);
+    push({Close{}});
+    push(node.statements);
+  }
+  auto visit(const Stmt *, const Stmt::Break &) -> void {}
+  auto visit(const Stmt *, const Stmt::Expression &node) -> void {
+    push({node.expression});
+  }
+  // The name is defined before the body so that the function can call
+  // itself. The body's own block does not open a second scope.
+  auto visit(const Stmt *stmt, const Stmt::Function &node) -> void {
+    declare(stmt, node.name.symbol, true);
+    open(stmt, true);
+    for (const auto &param : node.params)
+      declare(nullptr, param.symbol, true);
+    push({Close{}});
+    if (const auto *body = Parser::body(node)) {
+      if (const auto *block = std::get_if<Stmt::Block>(&body->stmt))
+        push(block->statements);
+      else
+        push({body});
+    }
+  }
+  auto visit(const Stmt *, const Stmt::If &node) -> void {
+    push({node.condition, node.thenBranch, node.elseBranch});
+  }
+  auto visit(const Stmt *, const Stmt::Print &node) -> void {
+    push({node.expression});
+  }
+  auto visit(const Stmt *, const Stmt::Return &node) -> void {
+    push({node.value});
+  }
+  auto visit(const Stmt *stmt, const Stmt::Var &node) -> void {
+    declare(stmt, node.name.symbol, false);
+    push({node.initializer, Define{node.name.symbol}});
+  }
+  auto visit(const Stmt *, const Stmt::While &node) -> void {
+    push({node.condition, node.body});
+  }
+};
+
+} // namespace
+
+auto resolve(std::span<Stmt *const> statements, Diagnostics &diagnostics)
+    -> Resolution {
+  return Resolver{diagnostics}.resolve(statements);
+}
@@ -0,0 +1,252 @@
+#include <scan.hpp>
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+namespace {
+
+auto isWhitespace(char c) -> bool {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+auto isIdentifier(char c) -> bool {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+auto whitespaceScalar(const char *p, const char *end) -> const char * {
+  while (p < end && isWhitespace(*p))
+    p++;
+  return p;
+}
+
+auto identifierScalar(const char *p, const char *end) -> const char * {
+  while (p < end && isIdentifier(*p))
+    p++;
+  return p;
+}
+
+auto findScalar(const char *p, const char *end, char c) -> const char * {
+  auto found = static_cast<const char *>(std::memchr(p, c, end - p));
+  return found ? found : end;
+}
+
+auto commentEndScalar(const char *p, const char *end) -> const char * {
+  for (; p + 1 < end; p++)
+    if (p[0] == '*' && p[1] == '/')
+      return p;
+  return end;
+}
+
+#ifdef SCAN_X86
+
+auto inRange(__m128i x, char lo, char hi) -> __m128i {
+  return _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(x, _mm_set1_epi8(lo)), x),
+                       _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(hi)), x));
+}
+
+auto whitespaceSSE2(const char *p, const char *end) -> const char * {
+  for (; p + 16 <= end; p += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    auto match = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(x, _mm_set1_epi8('\n'))),
+        _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\t')),
+                     _mm_cmpeq_epi8(x, _mm_set1_epi8('\r'))));
+    unsigned mask = ~_mm_movemask_epi8(match) & 0xffff;
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return whitespaceScalar(p, end);
+}
+
+auto identifierSSE2(const char *p, const char *end) -> const char * {
+  for (; p + 16 <= end; p += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    auto lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    auto match = _mm_or_si128(
+        _mm_or_si128(inRange(lower, 'a', 'z'), inRange(x, '0', '9')),
+        _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+    unsigned mask = ~_mm_movemask_epi8(match) & 0xffff;
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return identifierScalar(p, end);
+}
+
+auto findSSE2(const char *p, const char *end, char c) -> const char * {
+  for (; p + 16 <= end; p += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, _mm_set1_epi8(c)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return findScalar(p, end, c);
+}
+
+auto commentEndSSE2(const char *p, const char *end) -> const char * {
+  for (; p + 17 <= end; p += 16) {
+    auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    auto y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+    unsigned mask = _mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('*')),
+                      _mm_cmpeq_epi8(y, _mm_set1_epi8('/'))));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return commentEndScalar(p, end);
+}
+
+__attribute__((target("avx2"))) auto inRange(__m256i x, char lo, char hi)
+    -> __m256i {
+  return _mm256_and_si256(
+      _mm256_cmpeq_epi8(_mm256_max_epu8(x, _mm256_set1_epi8(lo)), x),
+      _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(hi)), x));
+}
+
+__attribute__((target("avx2"))) auto whitespaceAVX2(const char *p,
+                                                    const char *end)
+    -> const char * {
+  for (; p + 32 <= end; p += 32) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    auto match = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n'))),
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\t')),
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('\r'))));
+    unsigned mask = ~_mm256_movemask_epi8(match);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return whitespaceSSE2(p, end);
+}
+
+__attribute__((target("avx2"))) auto identifierAVX2(const char *p,
+                                                    const char *end)
+    -> const char * {
+  for (; p + 32 <= end; p += 32) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    auto lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    auto match = _mm256_or_si256(
+        _mm256_or_si256(inRange(lower, 'a', 'z'), inRange(x, '0', '9')),
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')));
+    unsigned mask = ~_mm256_movemask_epi8(match);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return identifierSSE2(p, end);
+}
+
+__attribute__((target("avx2"))) auto findAVX2(const char *p, const char *end,
+                                              char c) -> const char * {
+  for (; p + 32 <= end; p += 32) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    unsigned mask =
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(c)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return findSSE2(p, end, c);
+}
+
+__attribute__((target("avx2"))) auto commentEndAVX2(const char *p,
+                                                    const char *end)
+    -> const char * {
+  for (; p + 33 <= end; p += 32) {
+    auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+    unsigned mask = _mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('*')),
+                         _mm256_cmpeq_epi8(y, _mm256_set1_epi8('/'))));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return commentEndSSE2(p, end);
+}
+
+#endif // SCAN_X86
+
+struct Kernels {
+  scan::Isa isa;
+  const char *(*whitespace)(const char *, const char *);
+  const char *(*identifier)(const char *, const char *);
+  const char *(*find)(const char *, const char *, char);
+  const char *(*commentEnd)(const char *, const char *);
+};
+
+constexpr Kernels scalar = {scan::Isa::Scalar, whitespaceScalar,
+                            identifierScalar, findScalar, commentEndScalar};
+#ifdef SCAN_X86
+constexpr Kernels sse2 = {scan::Isa::SSE2, whitespaceSSE2, identifierSSE2,
+                          findSSE2, commentEndSSE2};
+constexpr Kernels avx2 = {scan::Isa::AVX2, whitespaceAVX2, identifierAVX2,
+                          findAVX2, commentEndAVX2};
+#endif
+
+auto supported(scan::Isa isa) -> const Kernels * {
+  switch (isa) {
+  case scan::Isa::Scalar:
+    return &scalar;
+#ifdef SCAN_X86
+  case scan::Isa::SSE2:
+    return __builtin_cpu_supports("sse2") ? &sse2 : nullptr;
+  case scan::Isa::AVX2:
+    return __builtin_cpu_supports("avx2") ? &avx2 : nullptr;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+const Kernels *kernels = [] {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+#endif
+  for (auto isa : {scan::Isa::AVX2, scan::Isa::SSE2})
+    if (auto selected = supported(isa))
+      return selected;
+  return &scalar;
+}();
+
+} // namespace
+
+auto scan::isa() -> Isa { return kernels->isa; }
+
+auto scan::setIsa(Isa isa) -> bool {
+  auto selected = supported(isa);
+  if (selected)
+    kernels = selected;
+  return selected;
+}
+
+auto scan::name(Isa isa) -> std::string_view {
+  switch (isa) {
+  case Isa::Scalar:
+    return "scalar";
+  case Isa::SSE2:
+    return "sse2";
+  case Isa::AVX2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+auto scan::whitespace(const char *p, const char *end) -> const char * {
+  return kernels->whitespace(p, end);
+}
+
+auto scan::identifier(const char *p, const char *end) -> const char * {
+  return kernels->identifier(p, end);
+}
+
+auto scan::find(const char *p, const char *end, char c) -> const char * {
+  return kernels->find(p, end, c);
+}
+
+auto scan::commentEnd(const char *p, const char *end) -> const char * {
+  return kernels->commentEnd(p, end);
+}
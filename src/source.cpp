@@ -0,0 +1,150 @@
+#include <source.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SOURCE_MMAP 1
+#endif
+
+Source::Source(std::string_view filename, std::string buffer)
+    : filename(filename), buffer(std::move(buffer)), text(this->buffer) {
+  index();
+}
+
+Source::Source(std::string_view filename, void *mapping, size_t size)
+    : filename(filename), text(static_cast<const char *>(mapping), size),
+      mapping(mapping) {
+  index();
+}
+
+Source::~Source() {
+#ifdef SOURCE_MMAP
+  if (mapping)
+    munmap(mapping, text.size());
+#endif
+}
+
+auto Source::index() -> void {
+  lines.push_back(0);
+
+  const char *begin = text.data();
+  const char *end = begin + text.size();
+  for (const char *p = begin;
+       (p = static_cast<const char *>(std::memchr(p, '\n', end - p)));)
+    lines.push_back(++p - begin);
+}
+
+auto Source::row(uint32_t offset) const -> int {
+  return std::upper_bound(lines.begin(), lines.end(), offset) - lines.begin();
+}
+
+auto Source::line(int row) const -> std::string_view {
+  if (row < 1 || static_cast<size_t>(row) > lines.size())
+    return {};
+
+  auto index = static_cast<size_t>(row);
+  uint32_t start = lines[index - 1];
+  uint32_t end = index < lines.size() ? lines[index] - 1 : text.size();
+  if (end > start && text[end - 1] == '\r')
+    end--;
+
+  return text.substr(start, end - start);
+}
+
+auto Source::replace(uint32_t offset, uint32_t length, std::string_view text)
+    -> void {
+  if (mapping) {
+    buffer.assign(this->text);
+#ifdef SOURCE_MMAP
+    munmap(mapping, this->text.size());
+#endif
+    mapping = nullptr;
+  }
+  buffer.replace(offset, length, text);
+  this->text = buffer;
+
+  // Line starts inside the replaced range are dropped, the ones after it
+  // move by the size difference, and the newlines of the new text are
+  // added in between.
+  auto first = std::upper_bound(lines.begin(), lines.end(), offset);
+  auto last = std::upper_bound(first, lines.end(), offset + length);
+  for (auto line = last; line != lines.end(); line++)
+    *line += text.size() - length;
+
+  std::vector<uint32_t> inserted;
+  for (size_t i = 0; i < text.size(); i++)
+    if (text[i] == '\n')
+      inserted.push_back(offset + i + 1);
+
+  first = lines.erase(first, last);
+  lines.insert(first, inserted.begin(), inserted.end());
+}
+
+auto SourceManager::instance() -> SourceManager & {
+  static SourceManager manager;
+  return manager;
+}
+
+auto SourceManager::add(std::string_view filename, std::string buffer)
+    -> std::optional<uint32_t> {
+  if (sources.size() >= maxSources)
+    return std::nullopt;
+
+  sources.emplace_back(filename, std::move(buffer));
+  return sources.size() - 1;
+}
+
+auto SourceManager::load(std::string_view filename)
+    -> std::optional<uint32_t> {
+  if (sources.size() >= maxSources)
+    return std::nullopt;
+
+  std::string path{filename};
+  FILE *file = path == "-" ? stdin : std::fopen(path.data(), "rb");
+  if (!file)
+    return std::nullopt;
+
+#ifdef SOURCE_MMAP
+  // Regular files are mapped and lexed in place; pipes, terminals and empty
+  // files cannot be mapped and fall through to reading into a buffer.
+  struct stat info;
+  if (fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode) &&
+      info.st_size > 0) {
+    void *mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE,
+                         fileno(file), 0);
+    if (mapping != MAP_FAILED) {
+      madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+      if (file != stdin)
+        std::fclose(file);
+
+      sources.emplace_back(filename, mapping, info.st_size);
+      return sources.size() - 1;
+    }
+  }
+#endif
+
+  std::string buffer;
+  char chunk[1 << 16];
+  while (size_t n = std::fread(chunk, 1, sizeof(chunk), file))
+    buffer.append(chunk, n);
+
+  bool failed = std::ferror(file);
+  if (file != stdin)
+    std::fclose(file);
+  if (failed)
+    return std::nullopt;
+
+  return add(filename, std::move(buffer));
+}
+
+auto SourceManager::get(uint32_t file) const -> const Source & {
+  return sources[file];
+}
+
+auto SourceManager::get(uint32_t file) -> Source & { return sources[file]; }
@@ -0,0 +1,16 @@
+# Runs BDS with ARGS on INPUT and fails unless what it prints to standard
+# output is EXPECTED, byte for byte. With UPDATE set the output is written to
+# EXPECTED instead, for when it is meant to change.
+execute_process(COMMAND ${BDS} ${ARGS} ${INPUT} OUTPUT_VARIABLE output)
+
+if(UPDATE)
+  file(WRITE ${EXPECTED} "${output}")
+  return()
+endif()
+
+file(READ ${EXPECTED} expected)
+if(NOT output STREQUAL expected)
+  file(WRITE ${EXPECTED}.actual "${output}")
+  message(FATAL_ERROR "${INPUT}: output differs from ${EXPECTED}, "
+                      "see ${EXPECTED}.actual")
+endif()
@@ -0,0 +1,38 @@
+# Writes an expression and a statement nested DEPTH levels deep, checks that
+# bds rejects both with NestingTooDeep under its default limit, and that
+# with --max-nesting raised past DEPTH it prints both in full.
+if(NOT DEPTH)
+  set(DEPTH 1000000)
+endif()
+math(EXPR limit "${DEPTH} * 3")
+
+string(REPEAT "-(" ${DEPTH} open)
+string(REPEAT ")" ${DEPTH} close)
+file(WRITE expression.bds "print ${open}1${close};\n")
+string(REPEAT "(unary - (grouping " ${DEPTH} open)
+string(REPEAT "))" ${DEPTH} close)
+set(expression "(print ${open}(literal 1)${close})\n")
+
+string(REPEAT "{" ${DEPTH} open)
+string(REPEAT "}" ${DEPTH} close)
+file(WRITE block.bds "${open}print 1;${close}\n")
+string(REPEAT "(block " ${DEPTH} open)
+string(REPEAT " )" ${DEPTH} close)
+set(block "${open}(print (literal 1))${close}\n")
+
+foreach(input expression block)
+  execute_process(COMMAND ${BDS} --diagnostics-format=json ${input}.bds
+                  OUTPUT_VARIABLE output)
+  string(FIND "${output}" "\"Nesting too deep\"" found)
+  if(found EQUAL -1)
+    message(FATAL_ERROR "${input}.bds: no nesting error by default:\n"
+                        "${output}")
+  endif()
+
+  execute_process(COMMAND ${BDS} --max-nesting=${limit} ${input}.bds
+                  OUTPUT_VARIABLE output RESULT_VARIABLE status)
+  if(NOT status EQUAL 0 OR NOT "${output}" STREQUAL "${${input}}")
+    message(FATAL_ERROR "${input}.bds: not printed back with "
+                        "--max-nesting=${limit}")
+  endif()
+endforeach()
@@ -0,0 +1,185 @@
+#include <diagnostics.hpp>
+#include <lexer.hpp>
+#include <scan.hpp>
+#include <source.hpp>
+
+#include <cstdint>
+#include <format>
+#include <initializer_list>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lexes a seeded random corpus with the scalar kernels and then with every
+// SIMD kernel set the CPU supports, and fails unless each set gives the
+// same tokens and errors. Whitespace, identifiers, strings and comments are
+// generated at every length up to a few vectors wide and follow one another
+// without alignment, so runs end at every offset within a vector and at the
+// end of the input. Stray and non-ASCII bytes, and strings and comments left
+// open at the end, cover the error paths.
+
+namespace {
+
+class Generator {
+  std::mt19937 random;
+
+  auto below(size_t n) -> size_t { return random() % n; }
+  auto pick(std::string_view chars) -> char {
+    return chars[below(chars.size())];
+  }
+  auto run(std::string &out, std::string_view chars, size_t max) -> void {
+    for (auto n = below(max + 1); n > 0; n--)
+      out += pick(chars);
+  }
+
+public:
+  explicit Generator(unsigned seed) : random(seed) {}
+
+  auto document(size_t size) -> std::string {
+    static constexpr std::string_view letters =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+    static constexpr std::string_view digits = "0123456789";
+    static constexpr std::string_view text =
+        "abc XYZ 019 _+-*/(){}!=<>;,.'\t*/*//\\";
+
+    std::string out;
+    while (out.size() < size) {
+      switch (below(10)) {
+      case 0:
+      case 1:
+        run(out, " \t\r\n", 80);
+        break;
+      case 2:
+      case 3:
+        out += pick(letters);
+        run(out, std::string(letters) + std::string(digits), 80);
+        break;
+      case 4:
+        run(out, digits, 20);
+        out += '1';
+        break;
+      case 5: {
+        std::string body;
+        run(body, text, 80);
+        std::erase(body, '"');
+        out += '"' + body + '"';
+        break;
+      }
+      case 6: {
+        out += "/*";
+        std::string body;
+        run(body, text, 80);
+        for (auto i = body.find("*/"); i != std::string::npos;
+             i = body.find("*/"))
+          body.erase(i, 2);
+        out += body + "*/";
+        break;
+      }
+      case 7:
+        out += "//";
+        run(out, text, 80);
+        out += '\n';
+        break;
+      case 8:
+        for (auto word : {"fn", "let", "print", "while", "==", "!=", "<=",
+                          ">=", "(", ")", "{", "}", ";", ","})
+          if (!below(4))
+            out += word;
+        break;
+      default:
+        out += pick("@#$`~?\x7f\x80\xa0\xc3\xff");
+        break;
+      }
+    }
+    // An unterminated string or comment takes the rest of the input.
+    if (!below(8))
+      out += below(2) ? "\"abc" : "/* abc";
+    return out;
+  }
+};
+
+struct Result {
+  std::vector<Token> tokens;
+  std::string errors;
+};
+
+auto lex(uint32_t file) -> Result {
+  Diagnostics diagnostics(0);
+  auto tokens = Lexer(file).scanTokens(diagnostics);
+  return {std::move(tokens), diagnostics.json()};
+}
+
+auto same(const Token &a, const Token &b) -> bool {
+  return a.type == b.type && a.offset == b.offset && a.length == b.length &&
+         a.symbol == b.symbol;
+}
+
+// Where the tokens of two runs first differ, or nothing if they do not.
+auto compare(const Result &expected, const Result &actual) -> std::string {
+  const auto &want = expected.tokens;
+  const auto &got = actual.tokens;
+  for (size_t i = 0; i < want.size() && i < got.size(); i++)
+    if (!same(want[i], got[i]))
+      return std::format("token {} at offset {} is type {} length {}, not "
+                         "type {} at offset {} length {}",
+                         i, got[i].offset, int(got[i].type), got[i].length,
+                         int(want[i].type), want[i].offset, want[i].length);
+  if (want.size() != got.size())
+    return std::format("{} tokens, not {}", got.size(), want.size());
+  if (expected.errors != actual.errors)
+    return std::format("errors\n{}\nnot\n{}", actual.errors, expected.errors);
+  return {};
+}
+
+} // namespace
+
+auto main(int argc, const char *argv[]) -> int {
+  unsigned seed = argc > 1 ? std::stoul(argv[1]) : 4;
+  size_t documents = argc > 2 ? std::stoul(argv[2]) : 2000;
+
+  Generator generator(seed);
+  std::vector<uint32_t> files;
+  for (size_t i = 0; i < documents; i++) {
+    // Mostly short documents, so that many end mid-vector, and a few large.
+    auto size = i % 100 == 99 ? 1 << 16 : 1 + i % 640;
+    auto file = SourceManager::instance().add(
+        std::format("random-{}-{}.bds", seed, i), generator.document(size));
+    if (!file)
+      return 1;
+    files.push_back(*file);
+  }
+
+  scan::setIsa(scan::Isa::Scalar);
+  std::vector<Result> expected;
+  for (auto file : files)
+    expected.push_back(lex(file));
+
+  int failures = 0;
+  for (auto isa : {scan::Isa::SSE2, scan::Isa::AVX2}) {
+    if (!scan::setIsa(isa)) {
+      std::cout << std::format("{}: not supported, skipped\n",
+                               scan::name(isa));
+      continue;
+    }
+
+    size_t tokens = 0;
+    std::string difference;
+    size_t i = 0;
+    for (; i < files.size() && difference.empty(); i++) {
+      auto actual = lex(files[i]);
+      tokens += actual.tokens.size();
+      difference = compare(expected[i], actual);
+    }
+    if (!difference.empty()) {
+      std::cout << std::format("{}: random-{}-{}.bds: {}\n", scan::name(isa),
+                               seed, i - 1, difference);
+      failures++;
+      continue;
+    }
+    std::cout << std::format("{}: {} documents, {} tokens\n", scan::name(isa),
+                             files.size(), tokens);
+  }
+  return failures ? 1 : 0;
+}